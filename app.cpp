@@ -1,7 +1,10 @@
 #include "app.h"
 #include "helpers.h"
 #include "constants.h"
+#include "embedded_shaders.h"
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <glm/detail/type_mat.hpp>
@@ -12,11 +15,28 @@
 #define GLM_FORCE_RADIANS
 #include <glm/gtc/matrix_transform.hpp>
 #include <chrono>
-
-ShadedCubeApp::ShadedCubeApp(ShaderProgram program) : shaderProgram(program) {
+#include <cmath>
+#include <random>
+
+// The host side of every block the embedded shaders share with it is checked
+// against their code, so the layouts can't drift apart unnoticed
+static_assert(UniformTransformObject::matches(spirvCode(SHADERS_VERT_SPV), 0, 0), "Transform block layout differs from shaders/shader.vert");
+static_assert(UniformLightObject::matches(spirvCode(SHADERS_UBER_SPV), 1, 0), "Light block layout differs from shaders/uber.frag");
+static_assert(UniformCullObject::matches(spirvCode(SHADERS_CULL_SPV), 0, 0), "Cull block layout differs from shaders/cull.comp");
+static_assert(spirvArrayStride(spirvCode(SHADERS_VERT_SPV), 0, 1) == sizeof(ObjectData), "ObjectData size differs from shaders/shader.vert");
+static_assert(spirvArrayStride(spirvCode(SHADERS_CULL_SPV), 0, 1) == sizeof(ObjectData), "ObjectData size differs from shaders/cull.comp");
+static_assert(spirvArrayStride(spirvCode(SHADERS_UBER_SPV), 1, 1) == sizeof(PointLight), "PointLight size differs from shaders/uber.frag");
+static_assert(spirvArrayStride(spirvCode(SHADERS_UBER_SPV), 1, 2) == sizeof(LightCluster), "LightCluster size differs from shaders/uber.frag");
+static_assert(UniformLightObject::matches(spirvCode(SHADERS_DEFERRED_SPV), 1, 0), "Light block layout differs from shaders/deferred.frag");
+static_assert(spirvArrayStride(spirvCode(SHADERS_DEFERRED_SPV), 1, 1) == sizeof(PointLight), "PointLight size differs from shaders/deferred.frag");
+static_assert(MAX_LOD_LEVELS <= DRAW_KEY_MAX_LODS, "LOD levels don't fit in a draw key");
+
+ShadedCubeApp::ShadedCubeApp(const AppConfig& config) : config(config) {
+    auto startupStart = std::chrono::high_resolution_clock::now();
     auto framebufferResizedCallback = [](GLFWwindow *window, int width, int height) {
         auto app = reinterpret_cast<ShadedCubeApp *>(glfwGetWindowUserPointer(window));
         app->framebufferResized = true;
+        app->requestRedraw();
     };
     window = new Window(
         this,
@@ -25,6 +45,40 @@ ShadedCubeApp::ShadedCubeApp(ShaderProgram program) : shaderProgram(program) {
         TITLE,
         static_cast<GLFWframebuffersizefun>(framebufferResizedCallback)
     );
+    auto mouseButtonCallback = [](GLFWwindow *window, int button, int action, int mods) {
+        auto app = reinterpret_cast<ShadedCubeApp *>(glfwGetWindowUserPointer(window));
+        if (action == GLFW_PRESS)
+            app->noteInput();
+        // Picking only reports what was hit, so it's part of --stats
+        if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && app->config.stats) {
+            double x, y;
+            app->window->getCursorPos(&x, &y);
+            app->pickObject(x, y);
+        }
+    };
+    window->setMouseButtonCallback(static_cast<GLFWmousebuttonfun>(mouseButtonCallback));
+    // Tab cycles through the shader programs, 0-3 set the number of lights,
+    // Space pauses and resumes the animation
+    auto keyCallback = [](GLFWwindow *window, int key, int scancode, int action, int mods) {
+        auto app = reinterpret_cast<ShadedCubeApp *>(glfwGetWindowUserPointer(window));
+        if (action != GLFW_PRESS)
+            return;
+        app->noteInput();
+        if (key == GLFW_KEY_TAB)
+            app->selectShaderProgram(static_cast<ShaderProgram>((app->config.shaderProgram + 1) % END_OF_SHADERS));
+        else if (key >= GLFW_KEY_0 && key <= GLFW_KEY_0 + static_cast<int>(MAX_LIGHTS))
+            app->config.lightCount = static_cast<uint32_t>(key - GLFW_KEY_0);
+        else if (key == GLFW_KEY_SPACE)
+            app->animating = !app->animating;
+    };
+    window->setKeyCallback(static_cast<GLFWkeyfun>(keyCallback));
+    auto refreshCallback = [](GLFWwindow *window) {
+        auto app = reinterpret_cast<ShadedCubeApp *>(glfwGetWindowUserPointer(window));
+        app->requestRedraw();
+    };
+    window->setRefreshCallback(static_cast<GLFWwindowrefreshfun>(refreshCallback));
+    // An on-demand scene stands still until it is started
+    animating = !config.onDemand;
     createInstance();
     setupDebugMessenger();
     createSurface();
@@ -34,30 +88,129 @@ ShadedCubeApp::ShadedCubeApp(ShaderProgram program) : shaderProgram(program) {
     createImageViews();
     createRenderPass();
     createDescriptorSetLayouts();
+    auto cacheLoadStart = std::chrono::high_resolution_clock::now();
+    pipelineLibrary.createCache(device, PIPELINE_CACHE_FILE);
+    auto cacheLoadEnd = std::chrono::high_resolution_clock::now();
     createGraphicsPipeline();
+    createLightingPipeline();
+    createComputePipelines();
+    createDepthResources();
+    createHiZResources();
+    createGBufferResources();
     createFramebuffers();
+    loadMesh();
+    createScene();
+    createPointLights();
     createVertexBuffer();
     createIndexBuffer();
+    createObjectBuffers();
+    createObjectStagingBuffers();
     createUniformTransforms();
     createUniformLights();
+    createLightClusterBuffers();
+    createUniformCulls();
+    createDrawUniforms();
     createDescriptorPool();
     createDescriptorSets();
+    createComputeDescriptorSets();
+    createLightingDescriptorSet();
     createCommandPool();
     createCommandBuffers();
+    createQueryPools();
     createSyncObjects();
+
+    if (config.stats) {
+        std::vector<std::string> programNames;
+        for(const auto& variant: SHADER_VARIANTS)
+            programNames.push_back(variant.name);
+        statsReporter.setProgramNames(programNames);
+
+        // Shaders come from the binary, so the pipeline cache is the only
+        // file read at startup
+        size_t shaderBytes = 0;
+        for(const auto& shader: EMBEDDED_SHADERS)
+            shaderBytes += shader.wordCount * sizeof(uint32_t);
+        auto startupEnd = std::chrono::high_resolution_clock::now();
+        printf(
+            "startup %.1f ms | shaders %.1f KiB embedded | pipeline cache %.1f KiB read in %.3f ms | present mode %s\n",
+            std::chrono::duration<double, std::milli>(startupEnd - startupStart).count(),
+            shaderBytes / 1024.0,
+            pipelineLibrary.getLoadedCacheSize() / 1024.0,
+            std::chrono::duration<double, std::milli>(cacheLoadEnd - cacheLoadStart).count(),
+            presentModeName(presentMode)
+        );
+    }
+
+    // Wakes up run() if it is waiting for events
+    if (config.hotReload)
+        shaderWatcher.reset(new ShaderWatcher("shaders", []() { glfwPostEmptyEvent(); }));
+
+    lastFrameStart = std::chrono::high_resolution_clock::now();
+    lastSceneUpdate = lastFrameStart;
+    requestRedraw();
 }
 
 ShadedCubeApp::~ShadedCubeApp() {
+    shaderWatcher.reset();
     cleanupSwapchain();
+    retireGraphicsPipelines();
+    destroyRetired(true);
 
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayouts[0], nullptr);
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayouts[1], nullptr);
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroyBuffer(device, objectStagingBuffers[i], nullptr);
+        vkFreeMemory(device, objectStagingBuffersMemory[i], nullptr);
+        vkDestroyBuffer(device, uniformLights[i], nullptr);
+        vkFreeMemory(device, uniformLightsMemory[i], nullptr);
+        vkDestroyBuffer(device, lightClusterBuffers[i], nullptr);
+        vkFreeMemory(device, lightClusterBuffersMemory[i], nullptr);
+        vkDestroyBuffer(device, uniformTransforms[i], nullptr);
+        vkFreeMemory(device, uniformTransformsMemory[i], nullptr);
+        vkDestroyBuffer(device, drawUniforms[i], nullptr);
+        vkFreeMemory(device, drawUniformsMemory[i], nullptr);
+        if (gpuCulling) {
+            vkDestroyBuffer(device, uniformCulls[i], nullptr);
+            vkFreeMemory(device, uniformCullsMemory[i], nullptr);
+        }
+    }
+    if (programQueriesEnabled) {
+        vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+        if (fragmentStatisticsSupported)
+            vkDestroyQueryPool(device, statisticsQueryPool, nullptr);
+    }
+
+    pipelineLibrary.destroyCache();
+    shaderModules.destroy(device);
+    descriptorAllocator.destroy();
+    swapchainDescriptorAllocator.destroy();
+    for(auto updateTemplate: updateTemplates)
+        vkDestroyDescriptorUpdateTemplate(device, updateTemplate, nullptr);
+    vkDestroyDescriptorUpdateTemplate(device, cullUpdateTemplate, nullptr);
+    vkDestroyDescriptorUpdateTemplate(device, hiZUpdateTemplate, nullptr);
+    vkDestroyDescriptorUpdateTemplate(device, lightingUpdateTemplate, nullptr);
+    setLayoutCache.destroy(device);
     for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
         vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
         vkDestroySemaphore(device, renderCompleteSemaphores[i], nullptr);
         vkDestroyFence(device, inFlightFences[i], nullptr);
     }
     vkDestroyCommandPool(device, commandPool, nullptr);
+    if (gpuCulling) {
+        vkDestroyBuffer(device, drawCountBuffer, nullptr);
+        vkFreeMemory(device, drawCountBufferMemory, nullptr);
+        vkDestroyBuffer(device, drawCommandBuffer, nullptr);
+        vkFreeMemory(device, drawCommandBufferMemory, nullptr);
+        vkDestroyBuffer(device, objectLodBuffer, nullptr);
+        vkFreeMemory(device, objectLodBufferMemory, nullptr);
+        if (occlusionCulling) {
+            vkDestroyPipeline(device, hiZPipeline, nullptr);
+            vkDestroyPipelineLayout(device, hiZPipelineLayout, nullptr);
+        }
+        vkDestroyPipeline(device, cullPipeline, nullptr);
+        vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+    }
+    vkDestroyBuffer(device, objectBuffer, nullptr);
+    vkFreeMemory(device, objectBufferMemory, nullptr);
+    bindlessDescriptors.destroy();
     vkDestroyBuffer(device, indexBuffer, nullptr);
     vkFreeMemory(device, indexBufferMemory, nullptr);
     vkDestroyBuffer(device, vertexBuffer, nullptr);
@@ -70,9 +223,20 @@ ShadedCubeApp::~ShadedCubeApp() {
 }
 
 void ShadedCubeApp::run() {
+    frameLimiter.setTargetFps(config.targetFps);
     while(!window->shouldClose()) {
+        // A minimized window has nothing to present to, and an on-demand
+        // one nothing new to show until an event changes something
+        if (window->isMinimized() || (config.onDemand && !redrawNeeded())) {
+            window->waitEvents();
+            continue;
+        }
+
+        // Wait before polling, so the frame sees the latest input
+        frameLimiter.beginFrame();
         window->pollEvents();
         drawFrame();
+        frameLimiter.endFrame();
     }
 
     vkDeviceWaitIdle(device);
@@ -287,11 +451,87 @@ void ShadedCubeApp::createLogicalDevice() {
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    VkPhysicalDeviceVulkan12Features supportedFeatures12 = {};
+    supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceVulkan12Properties properties12 = {};
+    properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    bool vulkan12 = properties.apiVersion >= VK_API_VERSION_1_2;
+    if (vulkan12) {
+        VkPhysicalDeviceFeatures2 supportedFeatures2 = {};
+        supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures2.pNext = &supportedFeatures12;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &properties12;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+    }
+
+    uint32_t queueFamilyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    // GPU culling dispatches on the graphics queue, and writes one draw per
+    // visible object with the object's index in firstInstance
+    gpuCulling = config.gpuCulling &&
+        (queueFamilies[indices.graphicsQueue.value()].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+        supportedFeatures.multiDrawIndirect &&
+        supportedFeatures.drawIndirectFirstInstance;
+    if (config.gpuCulling && !gpuCulling)
+        std::cout << "GPU culling is not supported, falling back to CPU culling\n";
+    occlusionCulling = gpuCulling && config.occlusionCulling;
+    drawIndirectCountSupported = gpuCulling && supportedFeatures12.drawIndirectCount;
+
+    // Bindless reads its buffers from a runtime sized array, written while
+    // command buffers that bound it may be pending
+    bindless = config.bindless &&
+        supportedFeatures12.runtimeDescriptorArray &&
+        supportedFeatures12.descriptorBindingPartiallyBound &&
+        supportedFeatures12.descriptorBindingStorageBufferUpdateAfterBind &&
+        supportedFeatures12.descriptorBindingUpdateUnusedWhilePending;
+    if (config.bindless && !bindless)
+        std::cout << "Descriptor indexing is not supported, falling back to bound descriptor sets\n";
+    bindlessCapacity = std::min({
+        BINDLESS_BUFFER_CAPACITY,
+        properties12.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+        properties12.maxDescriptorSetUpdateAfterBindStorageBuffers
+    });
+
+    objectData = gpuCulling || bindless ? OBJECT_DATA_INSTANCE : config.objectData;
+    if (objectData != config.objectData)
+        std::cout << "Falling back to the object buffer for per-draw data\n";
+    VkDeviceSize uniformAlignment = properties.limits.minUniformBufferOffsetAlignment;
+    drawUniformStride = (sizeof(glm::mat4) + uniformAlignment - 1) / uniformAlignment * uniformAlignment;
+    storageBufferAlignment = properties.limits.minStorageBufferOffsetAlignment;
+
     VkPhysicalDeviceFeatures features = {};
+    features.multiDrawIndirect = gpuCulling;
+    features.drawIndirectFirstInstance = gpuCulling;
+    VkPhysicalDeviceVulkan12Features features12 = {};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.drawIndirectCount = drawIndirectCountSupported;
+    features12.runtimeDescriptorArray = bindless;
+    features12.descriptorBindingPartiallyBound = bindless;
+    features12.descriptorBindingStorageBufferUpdateAfterBind = bindless;
+    features12.descriptorBindingUpdateUnusedWhilePending = bindless;
+
+    // --stats measures each shader program's GPU time, and its fragment
+    // shader invocations where pipeline statistics are available
+    programQueriesEnabled = config.stats && queueFamilies[indices.graphicsQueue.value()].timestampValidBits > 0;
+    fragmentStatisticsSupported = programQueriesEnabled && supportedFeatures.pipelineStatisticsQuery;
+    timestampPeriod = properties.limits.timestampPeriod;
+    features.pipelineStatisticsQuery = fragmentStatisticsSupported;
 
     // Device Create Info
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = vulkan12 ? &features12 : nullptr;
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pEnabledFeatures = &features;
@@ -311,6 +551,9 @@ void ShadedCubeApp::createLogicalDevice() {
     vkGetDeviceQueue(device, indices.graphicsQueue.value(), 0, &graphicsQueue);
     vkGetDeviceQueue(device, indices.computeQueue.value(), 0, &computeQueue);
     vkGetDeviceQueue(device, indices.presentQueue.value(), 0, &presentQueue);
+
+    if (bindless)
+        bindlessDescriptors.create(device, bindlessCapacity);
 }
 
 SwapchainSupportDetails ShadedCubeApp::querySwapchainSupport(VkPhysicalDevice device) {
@@ -344,7 +587,7 @@ SwapchainSupportDetails ShadedCubeApp::querySwapchainSupport(VkPhysicalDevice de
 void ShadedCubeApp::createSwapchain() {
     auto swapchainSupport = querySwapchainSupport(physicalDevice);
     auto surfaceFormat = chooseSwapSurfaceFormat(swapchainSupport.formats);
-    auto presentMode = chooseSwapPresentMode(swapchainSupport.presentModes);
+    presentMode = chooseSwapPresentMode(swapchainSupport.presentModes, PRESENT_MODE_PREFERENCES[config.presentPolicy]);
     auto extent = chooseSwapExtent(window, swapchainSupport.capabilities);
 
     uint32_t imageCount = swapchainSupport.capabilities.minImageCount + 1;
@@ -379,7 +622,9 @@ void ShadedCubeApp::createSwapchain() {
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
+    // Lets the presentation engine hand resources over from the old
+    // swapchain, whose acquired images can still be presented
+    createInfo.oldSwapchain = swapchain;
 
     handleVkResult(vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain), "Failed to create Swap Chain!");
 
@@ -423,106 +668,322 @@ void ShadedCubeApp::createRenderPass() {
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // The lighting subpass writes every pixel
+    if (config.deferred)
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+
+    // The Hi-Z pyramid is built from the depth buffer after the pass
+    depthFormat = findSupportedFormat(
+        physicalDevice,
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | (occlusionCulling ? VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT : 0)
+    );
+
+    VkAttachmentDescription depthAttachment = {};
+    depthAttachment.format = depthFormat;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = occlusionCulling ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = occlusionCulling ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference colorAttachmentRef = {};
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-    VkSubpassDescription subpass = {};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    // The G-buffer is cleared on load and never stored, so it only exists
+    // for the duration of the pass
+    VkAttachmentDescription gBufferAttachment = {};
+    gBufferAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    gBufferAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    gBufferAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    gBufferAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    gBufferAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    gBufferAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    gBufferAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkAttachmentDescription gBufferColorAttachment = gBufferAttachment;
+    gBufferColorAttachment.format = GBUFFER_COLOR_FORMAT;
+    VkAttachmentDescription gBufferNormalsAttachment = gBufferAttachment;
+    gBufferNormalsAttachment.format = GBUFFER_NORMALS_FORMAT;
+
+    std::array<VkAttachmentReference, 2> gBufferAttachmentRefs = {{
+        {2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+        {3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}
+    }};
+    std::array<VkAttachmentReference, 3> inputAttachmentRefs = {{
+        {2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+        {3, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+        {1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}
+    }};
+
+    // With --deferred, the geometry subpass writes the G-buffer and the
+    // lighting subpass reads it back
+    std::vector<VkSubpassDescription> subpasses(config.deferred ? 2 : 1);
+    subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpasses[0].colorAttachmentCount = config.deferred ? static_cast<uint32_t>(gBufferAttachmentRefs.size()) : 1;
+    subpasses[0].pColorAttachments = config.deferred ? gBufferAttachmentRefs.data() : &colorAttachmentRef;
+    subpasses[0].pDepthStencilAttachment = &depthAttachmentRef;
+    if (config.deferred) {
+        subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpasses[1].inputAttachmentCount = static_cast<uint32_t>(inputAttachmentRefs.size());
+        subpasses[1].pInputAttachments = inputAttachmentRefs.data();
+        subpasses[1].colorAttachmentCount = 1;
+        subpasses[1].pColorAttachments = &colorAttachmentRef;
+    }
+    uint32_t lastSubpass = static_cast<uint32_t>(subpasses.size() - 1);
+
+    std::vector<VkAttachmentDescription> attachments = {colorAttachment, depthAttachment};
+    if (config.deferred) {
+        attachments.push_back(gBufferColorAttachment);
+        attachments.push_back(gBufferNormalsAttachment);
+    }
 
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
-    renderPassInfo.subpassCount = 1;
-    renderPassInfo.pSubpasses = &subpass;
-
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+    renderPassInfo.pSubpasses = subpasses.data();
+
+    // The depth buffer is shared between frames, so this frame's depth
+    // writes wait for the previous frame's, and for the Hi-Z build reading
+    // it. So is the G-buffer, which the previous frame's lighting read.
+    std::vector<VkSubpassDependency> dependencies(1);
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    if (occlusionCulling)
+        dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    if (config.deferred) {
+        dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[0].srcAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    }
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    // Each pixel is lit from what was written at that pixel only, which
+    // lets a tiler keep the G-buffer in tile memory between the subpasses
+    if (config.deferred) {
+        VkSubpassDependency gBufferDependency = {};
+        gBufferDependency.srcSubpass = 0;
+        gBufferDependency.dstSubpass = 1;
+        gBufferDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        gBufferDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        gBufferDependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        gBufferDependency.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+        gBufferDependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+        dependencies.push_back(gBufferDependency);
+    }
+
+    if (occlusionCulling) {
+        VkSubpassDependency hiZDependency = {};
+        hiZDependency.srcSubpass = lastSubpass;
+        hiZDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+        hiZDependency.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        if (config.deferred)
+            hiZDependency.srcStageMask |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        hiZDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        hiZDependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        hiZDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependencies.push_back(hiZDependency);
+    }
+
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
 
     handleVkResult(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass), "Failed to create Render Pass!");
 }
 
 void ShadedCubeApp::createDescriptorSetLayouts() {
-    descriptorSetLayouts.resize(2);
+    // All graphics pipelines share one pipeline layout, so it covers
+    // whatever any of the programs use
+    graphicsLayout = reflectGraphicsShaders();
+
+    // The shaders must not read past what updateUniforms() and
+    // recordCommandBuffer() write
+    if (graphicsLayout.getUniformSize(0, 0) > UniformTransformObject::SIZE || graphicsLayout.getUniformSize(1, 0) > UniformLightObject::SIZE || graphicsLayout.getUniformSize(2, 0) > sizeof(glm::mat4))
+        throw std::runtime_error("Uniform block is larger than the data written to it!");
+
+    descriptorSetLayouts.clear();
+    for(const auto& bindings: graphicsLayout.getSets())
+        descriptorSetLayouts.push_back(setLayoutCache.get(device, bindings));
+
+    // The shader only declares an unsized array; the real layout, with its
+    // binding flags, comes from BindlessDescriptors
+    if (bindless) {
+        const VkDescriptorSetLayoutBinding *buffers = graphicsLayout.findBinding(0, 0);
+        if (graphicsLayout.getSets()[0].size() != 1 || buffers == nullptr || buffers->descriptorType != VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+            throw std::runtime_error("Bindless shaders must only use an array of storage buffers in set 0!");
+        descriptorSetLayouts[0] = bindlessDescriptors.getLayout();
+    }
 
-    VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-    uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.stageFlags =  VK_SHADER_STAGE_VERTEX_BIT;
+    updateTemplates.clear();
+    for(uint32_t set = 0; set < descriptorSetLayouts.size(); set++) {
+        bool shared = bindless && set == 0;
+        updateTemplates.push_back(shared ? VK_NULL_HANDLE : graphicsLayout.createUpdateTemplate(device, set, descriptorSetLayouts[set]));
+    }
 
-    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 1;
-    layoutInfo.pBindings = &uboLayoutBinding;
+    if (!config.deferred)
+        return;
 
-    handleVkResult(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayouts[0]), "Failed to create a Descriptor Set Layout!");
+    // The lighting subpass binds the graphics pipelines' light set, so it
+    // has to declare the same bindings, and read no more than they're given
+    lightingLayout = reflectLightingShaders();
+    const auto& lightingSets = lightingLayout.getSets();
+    if (lightingSets.size() != 2 || descriptorSetLayouts.size() < 2 || setLayoutCache.get(device, lightingSets[1]) != descriptorSetLayouts[1]
+            || lightingLayout.getUniformSize(1, 0) > graphicsLayout.getUniformSize(1, 0))
+        throw std::runtime_error("The lighting shader's set 1 must match the graphics shaders' light set!");
 
-    VkDescriptorSetLayoutBinding loLayoutBinding = {};
-    loLayoutBinding.binding = 0;
-    loLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    loLayoutBinding.descriptorCount = 1;
-    loLayoutBinding.stageFlags =  VK_SHADER_STAGE_FRAGMENT_BIT;
+    lightingSetLayouts = {setLayoutCache.get(device, lightingSets[0]), descriptorSetLayouts[1]};
+    lightingUpdateTemplate = lightingLayout.createUpdateTemplate(device, 0, lightingSetLayouts[0]);
+}
 
-    layoutInfo = {};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 1;
-    layoutInfo.pBindings = &loLayoutBinding;
+ShaderLayout ShadedCubeApp::reflectGraphicsShaders() {
+    ShaderLayout layout;
+    layout.addStage(loadShaderCode(vertexShaderFile()), VK_SHADER_STAGE_VERTEX_BIT);
+    layout.addStage(loadShaderCode(FRAGMENT_SHADER_FILE), VK_SHADER_STAGE_FRAGMENT_BIT);
+    layout.setDynamic(2, 0);
+    return layout;
+}
 
-    handleVkResult(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayouts[1]), "Failed to create a Descriptor Set Layout!");
+ShaderLayout ShadedCubeApp::reflectLightingShaders() {
+    ShaderLayout layout;
+    layout.addStage(loadShaderCode(FULLSCREEN_SHADER_FILE), VK_SHADER_STAGE_VERTEX_BIT);
+    layout.addStage(loadShaderCode(DEFERRED_SHADER_FILE), VK_SHADER_STAGE_FRAGMENT_BIT);
+    return layout;
 }
 
 void ShadedCubeApp::createGraphicsPipeline() {
-    auto vertShaderModule = createShaderModule(device, "shaders/vert.spv");
-    auto fragShaderModule = createShaderModule(device, "shaders/frag.spv");
-    if (shaderProgram == ShaderProgram::BRIGHT_SHADER) {
-        vkDestroyShaderModule(device, fragShaderModule, nullptr);
-        fragShaderModule = createShaderModule(device, "shaders/bright.spv");
+    const auto& pushConstantRanges = graphicsLayout.getPushConstantRanges();
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+    pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
+    handleVkResult(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout), "Failed to create pipeline layout!");
+
+    if (enableValidationLayers) {
+        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+        std::cout << "AttributeDescriptions:\n";
+        for(size_t i=0; i<attributeDescriptions.size(); i++) {
+            std::cout << "AttributeDescription #" << i+1 << "\n";
+
+            std::cout << "description.format: " << attributeDescriptions[i].format << "\n";
+
+            std::cout << "\n";
+        }
+    }
+
+    vertShaderModule = shaderModules.get(device, loadShaderCode(vertexShaderFile()));
+    fragShaderModule = shaderModules.get(device, loadShaderCode(FRAGMENT_SHADER_FILE));
+    resetPipelineLibrary();
+    precompilePipelines();
+}
+
+void ShadedCubeApp::resetPipelineLibrary() {
+    // Workers only see the modules, layout and render pass that are current
+    // now; release() runs before any of them change
+    VkShaderModule vert = vertShaderModule, frag = fragShaderModule;
+    pipelineLibrary.reset(END_OF_SHADERS * (MAX_LIGHTS + 1), [this, vert, frag](uint32_t variant, VkPipelineCache cache) {
+        return buildGraphicsPipeline(vert, frag, variant, cache);
+    });
+}
+
+// Every program with every light count it can be specialized for, built by
+// the workers. Only the fallback is waited for; the ones the current
+// settings use are queued right after it.
+void ShadedCubeApp::precompilePipelines() {
+    std::vector<uint32_t> variants = {pipelineVariant(FALLBACK_SHADER, 0)};
+    for(uint32_t program = 0; program < END_OF_SHADERS; program++)
+        variants.push_back(pipelineVariant(program, config.lightCount));
+    for(uint32_t program = 0; program < END_OF_SHADERS; program++) {
+        for(uint32_t lightCount = 0; lightCount <= MAX_LIGHTS; lightCount++)
+            variants.push_back(pipelineVariant(program, lightCount));
+    }
+    pipelineLibrary.precompile(workerPool(), variants);
+    fallbackPipeline = pipelineLibrary.get(variants[0]);
+}
+
+// Never blocks on a pipeline build: programs whose variant isn't ready yet
+// are drawn with the fallback until it is
+void ShadedCubeApp::selectPipelines() {
+    for(uint32_t program = 0; program < END_OF_SHADERS; program++) {
+        VkPipeline pipeline = pipelineLibrary.request(workerPool(), pipelineVariant(program, config.lightCount));
+        if (pipeline == VK_NULL_HANDLE) {
+            pipeline = fallbackPipeline;
+            if (programObjectCounts[program] > 0)
+                frameStats.fallbackPrograms++;
+        }
+        graphicsPipelines[program] = pipeline;
     }
+}
+
+// Programs that don't light anything share one variant for all light counts,
+// as do the ones that only write the G-buffer
+uint32_t ShadedCubeApp::pipelineVariant(uint32_t program, uint32_t lightCount) const {
+    if (config.deferred)
+        return program * (MAX_LIGHTS + 1);
+    return program * (MAX_LIGHTS + 1) + std::min(SHADER_VARIANTS[program].lightCount, lightCount);
+}
 
+VkPipeline ShadedCubeApp::buildGraphicsPipeline(VkShaderModule vertShaderModule, VkShaderModule fragShaderModule, uint32_t variant, VkPipelineCache cache) {
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
     vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
     vertShaderStageInfo.module = vertShaderModule;
     vertShaderStageInfo.pName = "main";
 
+    uint32_t objectDataSource = objectData;
+    VkSpecializationMapEntry objectDataEntry = {0, 0, sizeof(uint32_t)};
+    VkSpecializationInfo vertSpecializationInfo = {};
+    vertSpecializationInfo.mapEntryCount = 1;
+    vertSpecializationInfo.pMapEntries = &objectDataEntry;
+    vertSpecializationInfo.dataSize = sizeof(uint32_t);
+    vertSpecializationInfo.pData = &objectDataSource;
+    vertShaderStageInfo.pSpecializationInfo = &vertSpecializationInfo;
+
+    // Each variant specializes the fragment shader's constants, so the
+    // driver compiles only the lighting that variant uses
+    std::array<VkSpecializationMapEntry, 3> specializationEntries = {{
+        {0, offsetof(ShaderVariant, lightingModel), sizeof(uint32_t)},
+        {1, offsetof(ShaderVariant, lightCount), sizeof(uint32_t)},
+        {2, offsetof(ShaderVariant, gBuffer), sizeof(VkBool32)}
+    }};
+    ShaderVariant shaderVariant = SHADER_VARIANTS[variant / (MAX_LIGHTS + 1)];
+    shaderVariant.lightCount = variant % (MAX_LIGHTS + 1);
+    shaderVariant.gBuffer = config.deferred;
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+    specializationInfo.pMapEntries = specializationEntries.data();
+    specializationInfo.dataSize = sizeof(ShaderVariant);
+    specializationInfo.pData = &shaderVariant;
+
     VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
     fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     fragShaderStageInfo.module = fragShaderModule;
     fragShaderStageInfo.pName = "main";
+    fragShaderStageInfo.pSpecializationInfo = &specializationInfo;
 
-    VkPipelineShaderStageCreateInfo shaderStageInfos[] = {
-        vertShaderStageInfo,
-        fragShaderStageInfo
-    };
+    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
     auto bindingDescription = Vertex::getBindingDescription();
     auto attributeDescriptions = Vertex::getAttributeDescriptions();
 
-    if (enableValidationLayers) {
-        std::cout << "AttributeDescriptions:\n";
-        for(size_t i=0; i<attributeDescriptions.size(); i++) {
-            std::cout << "AttributeDescription #" << i+1 << "\n";
-
-            std::cout << "description.format: " << attributeDescriptions[i].format << "\n";
-
-            std::cout << "\n";
-        }
-    }
-
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     vertexInputInfo.vertexBindingDescriptionCount = 1;
@@ -535,22 +996,11 @@ void ShadedCubeApp::createGraphicsPipeline() {
     inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
 
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float) swapchainExtent.width;
-    viewport.height = (float) swapchainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    VkRect2D scissor = {};
-    scissor.offset = {0, 0};
-    scissor.extent = swapchainExtent;
+    // Set while recording, so resizing the window doesn't need new pipelines
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
 
     VkPipelineRasterizationStateCreateInfo rasterizer = {};
     rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -567,19 +1017,29 @@ void ShadedCubeApp::createGraphicsPipeline() {
     multisampling.sampleShadingEnable = VK_FALSE;
     multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
     VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
     colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
     colorBlendAttachment.blendEnable = VK_FALSE;
+    // One per G-buffer attachment with --deferred
+    std::array<VkPipelineColorBlendAttachmentState, 2> colorBlendAttachments = {colorBlendAttachment, colorBlendAttachment};
 
     VkPipelineColorBlendStateCreateInfo colorBlending = {};
     colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
+    colorBlending.attachmentCount = config.deferred ? static_cast<uint32_t>(colorBlendAttachments.size()) : 1;
+    colorBlending.pAttachments = colorBlendAttachments.data();
 
     VkDynamicState dynamicStates[] = {
         VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_LINE_WIDTH
+        VK_DYNAMIC_STATE_SCISSOR
     };
 
     VkPipelineDynamicStateCreateInfo dynamicState = {};
@@ -587,26 +1047,19 @@ void ShadedCubeApp::createGraphicsPipeline() {
     dynamicState.dynamicStateCount = 2;
     dynamicState.pDynamicStates = dynamicStates;
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 2;
-    pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
-
-    handleVkResult(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout), "Failed to create pipeline layout!");
-
     VkGraphicsPipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStageInfos;
+    pipelineInfo.pStages = shaderStages;
 
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = nullptr; // Optional
+    pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = nullptr; // Optional
+    pipelineInfo.pDynamicState = &dynamicState;
 
     pipelineInfo.layout = pipelineLayout;
 
@@ -616,24 +1069,426 @@ void ShadedCubeApp::createGraphicsPipeline() {
     pipelineInfo.basePipelineIndex = -1;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    handleVkResult(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline), "Failed to create Graphics Pipeline!");
+    VkPipeline pipeline;
+    handleVkResult(vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline), "Failed to create Graphics Pipeline!");
+    return pipeline;
+}
+
+void ShadedCubeApp::createComputePipelines() {
+    if (!gpuCulling)
+        return;
+
+    cullLayout = ShaderLayout();
+    cullLayout.addStage(loadShaderCode(CULL_SHADER_FILE), VK_SHADER_STAGE_COMPUTE_BIT);
+    if (cullLayout.getUniformSize(0, 0) > UniformCullObject::SIZE)
+        throw std::runtime_error("Uniform block is larger than the data written to it!");
+
+    cullSetLayout = setLayoutCache.get(device, cullLayout.getSets().at(0));
+    cullUpdateTemplate = cullLayout.createUpdateTemplate(device, 0, cullSetLayout);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &cullSetLayout;
+
+    handleVkResult(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullPipelineLayout), "Failed to create pipeline layout!");
+
+    cullPipeline = buildComputePipeline(CULL_SHADER_FILE, cullPipelineLayout);
+
+    if (!occlusionCulling)
+        return;
+
+    hiZLayout = ShaderLayout();
+    hiZLayout.addStage(loadShaderCode(HIZ_SHADER_FILE), VK_SHADER_STAGE_COMPUTE_BIT);
+    hiZSetLayout = setLayoutCache.get(device, hiZLayout.getSets().at(0));
+    hiZUpdateTemplate = hiZLayout.createUpdateTemplate(device, 0, hiZSetLayout);
+
+    pipelineLayoutInfo.pSetLayouts = &hiZSetLayout;
+
+    handleVkResult(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &hiZPipelineLayout), "Failed to create pipeline layout!");
+
+    hiZPipeline = buildComputePipeline(HIZ_SHADER_FILE, hiZPipelineLayout);
+}
+
+VkPipeline ShadedCubeApp::buildComputePipeline(const std::string& shaderFile, VkPipelineLayout layout) {
+    auto shaderModule = shaderModules.get(device, loadShaderCode(shaderFile));
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = layout;
+
+    VkPipeline pipeline;
+    handleVkResult(vkCreateComputePipelines(device, pipelineLibrary.getCache(), 1, &pipelineInfo, nullptr, &pipeline), "Failed to create Compute Pipeline!");
+    return pipeline;
+}
+
+void ShadedCubeApp::createLightingPipeline() {
+    if (!config.deferred)
+        return;
+
+    const auto& pushConstantRanges = lightingLayout.getPushConstantRanges();
+    if (pushConstantRanges.size() != 1 || pushConstantRanges[0].offset + pushConstantRanges[0].size > sizeof(LightingConstants))
+        throw std::runtime_error("Lighting shader push constants are larger than the data pushed!");
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(lightingSetLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = lightingSetLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+    pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
+    handleVkResult(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &lightingPipelineLayout), "Failed to create pipeline layout!");
+
+    lightingPipeline = buildLightingPipeline(pipelineLibrary.getCache());
+}
+
+// A full-screen triangle in the second subpass, without vertex buffers or
+// depth testing
+VkPipeline ShadedCubeApp::buildLightingPipeline(VkPipelineCache cache) {
+    std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = shaderModules.get(device, loadShaderCode(FULLSCREEN_SHADER_FILE));
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = shaderModules.get(device, loadShaderCode(DEFERRED_SHADER_FILE));
+    shaderStages[1].pName = "main";
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {};
+    inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkDynamicState dynamicStates[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+    };
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+    pipelineInfo.pStages = shaderStages.data();
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = lightingPipelineLayout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 1;
+    pipelineInfo.basePipelineIndex = -1;
+
+    VkPipeline pipeline;
+    handleVkResult(vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline), "Failed to create Graphics Pipeline!");
+    return pipeline;
+}
+
+const std::string& ShadedCubeApp::vertexShaderFile() const {
+    return bindless ? BINDLESS_VERTEX_SHADER_FILE : VERTEX_SHADER_FILE;
+}
+
+SpirvCode ShadedCubeApp::loadShaderCode(const std::string& shaderFile) {
+    auto reloaded = reloadedShaders.find(shaderFile);
+    if (reloaded != reloadedShaders.end())
+        return reloaded->second;
 
-    vkDestroyShaderModule(device, fragShaderModule, nullptr);
-    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+    for(const auto& shader: EMBEDDED_SHADERS) {
+        if (shaderFile == shader.file)
+            return SpirvCode(shader.words, shader.wordCount);
+    }
+    throw std::runtime_error("Shader " + shaderFile + " is not built into the app!");
+}
+
+void ShadedCubeApp::reloadShaders() {
+    auto shaders = shaderWatcher->takeCompiled();
+    if (shaders.empty())
+        return;
+
+    auto previousShaders = reloadedShaders;
+    bool reloadGraphics = false, reloadCull = false, reloadHiZ = false, reloadLighting = false;
+    for(auto& shader: shaders) {
+        auto source = std::find_if(SHADER_SOURCES.begin(), SHADER_SOURCES.end(), [&](const std::pair<std::string, std::string>& entry) {
+            return entry.first == shader.source;
+        });
+        if (source == SHADER_SOURCES.end())
+            continue;
+
+        const std::string& shaderFile = source->second;
+        reloadedShaders[shaderFile] = std::move(shader.spirv);
+        std::cout << "Reloading " << shader.source << "\n";
+
+        reloadGraphics = reloadGraphics || shaderFile == vertexShaderFile() || shaderFile == FRAGMENT_SHADER_FILE;
+        reloadCull = reloadCull || (gpuCulling && shaderFile == CULL_SHADER_FILE);
+        reloadHiZ = reloadHiZ || (occlusionCulling && shaderFile == HIZ_SHADER_FILE);
+        reloadLighting = reloadLighting || (config.deferred && (shaderFile == FULLSCREEN_SHADER_FILE || shaderFile == DEFERRED_SHADER_FILE));
+    }
+
+    // Everything in use is built before anything is swapped, so a shader
+    // that compiles but fails pipeline creation leaves all pipelines as they
+    // were. The other graphics variants are queued once the new shaders
+    // are known to work.
+    VkShaderModule newVertShaderModule = VK_NULL_HANDLE, newFragShaderModule = VK_NULL_HANDLE;
+    std::vector<std::pair<uint32_t, VkPipeline>> pipelines;
+    VkPipeline newCullPipeline = VK_NULL_HANDLE, newHiZPipeline = VK_NULL_HANDLE, newLightingPipeline = VK_NULL_HANDLE;
+    try {
+        // The set layouts, pipeline layouts and buffers stay as they are, so
+        // the new shaders have to declare exactly what the old ones did.
+        // Equal uniform block sizes also keep them within the data written.
+        auto reflectCompute = [&](const std::string& shaderFile) {
+            ShaderLayout layout;
+            layout.addStage(loadShaderCode(shaderFile), VK_SHADER_STAGE_COMPUTE_BIT);
+            return layout;
+        };
+        if ((reloadGraphics && !reflectGraphicsShaders().sameInterface(graphicsLayout))
+                || (reloadCull && !reflectCompute(CULL_SHADER_FILE).sameInterface(cullLayout))
+                || (reloadHiZ && !reflectCompute(HIZ_SHADER_FILE).sameInterface(hiZLayout))
+                || (reloadLighting && !reflectLightingShaders().sameInterface(lightingLayout)))
+            throw std::runtime_error("Shader resources differ from the ones the pipelines were laid out for, restart to apply them!");
+
+        if (reloadGraphics) {
+            newVertShaderModule = shaderModules.get(device, loadShaderCode(vertexShaderFile()));
+            newFragShaderModule = shaderModules.get(device, loadShaderCode(FRAGMENT_SHADER_FILE));
+            std::set<uint32_t> variants = {pipelineVariant(FALLBACK_SHADER, 0)};
+            for(uint32_t program = 0; program < END_OF_SHADERS; program++)
+                variants.insert(pipelineVariant(program, config.lightCount));
+            for(uint32_t variant: variants)
+                pipelines.push_back({variant, buildGraphicsPipeline(newVertShaderModule, newFragShaderModule, variant, pipelineLibrary.getCache())});
+        }
+        if (reloadCull)
+            newCullPipeline = buildComputePipeline(CULL_SHADER_FILE, cullPipelineLayout);
+        if (reloadHiZ)
+            newHiZPipeline = buildComputePipeline(HIZ_SHADER_FILE, hiZPipelineLayout);
+        if (reloadLighting)
+            newLightingPipeline = buildLightingPipeline(pipelineLibrary.getCache());
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Shader reload failed: " << e.what() << "\n";
+        for(auto& pipeline: pipelines)
+            vkDestroyPipeline(device, pipeline.second, nullptr);
+        if (newCullPipeline != VK_NULL_HANDLE)
+            vkDestroyPipeline(device, newCullPipeline, nullptr);
+        if (newHiZPipeline != VK_NULL_HANDLE)
+            vkDestroyPipeline(device, newHiZPipeline, nullptr);
+        reloadedShaders = previousShaders;
+        return;
+    }
+
+    if (reloadGraphics) {
+        for(auto pipeline: pipelineLibrary.release())
+            retirePipeline(pipeline);
+        vertShaderModule = newVertShaderModule;
+        fragShaderModule = newFragShaderModule;
+
+        resetPipelineLibrary();
+        for(auto& pipeline: pipelines)
+            pipelineLibrary.insert(pipeline.first, pipeline.second);
+        precompilePipelines();
+    }
+    if (reloadCull) {
+        retirePipeline(cullPipeline);
+        cullPipeline = newCullPipeline;
+    }
+    if (reloadHiZ) {
+        retirePipeline(hiZPipeline);
+        hiZPipeline = newHiZPipeline;
+    }
+    if (reloadLighting) {
+        retirePipeline(lightingPipeline);
+        lightingPipeline = newLightingPipeline;
+    }
+}
+
+void ShadedCubeApp::retire(std::function<void()> destroy) {
+    retiredObjects.push_back({frameNumber, std::move(destroy)});
+}
+
+void ShadedCubeApp::retirePipeline(VkPipeline pipeline) {
+    retire([this, pipeline]() { vkDestroyPipeline(device, pipeline, nullptr); });
+}
+
+void ShadedCubeApp::retireBuffer(VkBuffer buffer, VkDeviceMemory memory) {
+    retire([this, buffer, memory]() {
+        vkDestroyBuffer(device, buffer, nullptr);
+        vkFreeMemory(device, memory, nullptr);
+    });
+}
+
+void ShadedCubeApp::destroyRetired(bool all) {
+    // Waiting on a frame's fence also covers everything submitted before it,
+    // so after MAX_FRAMES_IN_FLIGHT more frames no command buffer recorded
+    // before the object was retired can still be executing
+    auto done = std::stable_partition(retiredObjects.begin(), retiredObjects.end(), [&](const std::pair<uint64_t, std::function<void()>>& retired) {
+        return !all && frameNumber < retired.first + MAX_FRAMES_IN_FLIGHT;
+    });
+    for(auto retired = done; retired != retiredObjects.end(); ++retired)
+        retired->second();
+    retiredObjects.erase(done, retiredObjects.end());
+}
+
+void ShadedCubeApp::createDepthResources() {
+    // Unless the Hi-Z build reads it after the pass, depth never has to
+    // leave it either
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    VkMemoryPropertyFlags memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    if (config.deferred)
+        usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+    if (occlusionCulling)
+        usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+    else {
+        usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        memoryProperties = transientMemoryProperties(physicalDevice);
+    }
+
+    createImage(
+        physicalDevice,
+        device,
+        swapchainExtent.width,
+        swapchainExtent.height,
+        1,
+        depthFormat,
+        usage,
+        memoryProperties,
+        depthImage,
+        depthImageMemory
+    );
+    depthImageView = createImageView(device, depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1);
+}
+
+void ShadedCubeApp::createHiZResources() {
+    if (!gpuCulling)
+        return;
+
+    // Without occlusion culling the pyramid is never built, but the
+    // culling shader still needs an image bound to it
+    hiZExtent = occlusionCulling ? swapchainExtent : VkExtent2D{1, 1};
+    hiZLevels = 1;
+    for(uint32_t size = std::max(hiZExtent.width, hiZExtent.height); size > 1; size /= 2)
+        hiZLevels++;
+
+    createImage(
+        physicalDevice,
+        device,
+        hiZExtent.width,
+        hiZExtent.height,
+        hiZLevels,
+        VK_FORMAT_R32_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        hiZImage,
+        hiZImageMemory
+    );
+    hiZImageView = createImageView(device, hiZImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, hiZLevels);
+    hiZMipViews.resize(hiZLevels);
+    for(uint32_t level = 0; level < hiZLevels; level++)
+        hiZMipViews[level] = createImageView(device, hiZImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, level, 1);
+
+    // Only ever read with texelFetch
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = static_cast<float>(hiZLevels);
+
+    handleVkResult(vkCreateSampler(device, &samplerInfo, nullptr, &hiZSampler), "Failed to create sampler!");
+
+    hiZValid = false;
+}
+
+void ShadedCubeApp::createGBufferResources() {
+    if (!config.deferred)
+        return;
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    VkMemoryPropertyFlags memoryProperties = transientMemoryProperties(physicalDevice);
+
+    createImage(
+        physicalDevice,
+        device,
+        swapchainExtent.width,
+        swapchainExtent.height,
+        1,
+        GBUFFER_COLOR_FORMAT,
+        usage,
+        memoryProperties,
+        gBufferColorImage,
+        gBufferColorMemory
+    );
+    gBufferColorView = createImageView(device, gBufferColorImage, GBUFFER_COLOR_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1);
+
+    createImage(
+        physicalDevice,
+        device,
+        swapchainExtent.width,
+        swapchainExtent.height,
+        1,
+        GBUFFER_NORMALS_FORMAT,
+        usage,
+        memoryProperties,
+        gBufferNormalsImage,
+        gBufferNormalsMemory
+    );
+    gBufferNormalsView = createImageView(device, gBufferNormalsImage, GBUFFER_NORMALS_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1);
 }
 
 void ShadedCubeApp::createFramebuffers() {
     swapchainFramebuffers.resize(swapchainImageViews.size());
     for(size_t i = 0; i < swapchainImageViews.size(); i++) {
-        VkImageView attachments[] = {
-            swapchainImageViews[i]
+        // In the order of the render pass's attachments
+        std::vector<VkImageView> attachments = {
+            swapchainImageViews[i],
+            depthImageView
         };
+        if (config.deferred) {
+            attachments.push_back(gBufferColorView);
+            attachments.push_back(gBufferNormalsView);
+        }
 
         VkFramebufferCreateInfo framebufferInfo = {};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebufferInfo.renderPass = renderPass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = attachments;
+        framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        framebufferInfo.pAttachments = attachments.data();
         framebufferInfo.width = swapchainExtent.width;
         framebufferInfo.height = swapchainExtent.height;
         framebufferInfo.layers = 1;
@@ -642,9 +1497,155 @@ void ShadedCubeApp::createFramebuffers() {
     }
 }
 
+void ShadedCubeApp::loadMesh() {
+    std::vector<uint16_t> meshIndices = indices;
+    meshVertices = vertices;
+    if (config.sphereMesh)
+        buildSphere(SPHERE_SUBDIVISIONS, meshVertices, meshIndices);
+    meshLods = buildLodChain(meshVertices, meshIndices);
+
+    if (enableValidationLayers) {
+        std::cout << "Mesh LODs:\n";
+        for(size_t i=0; i<meshLods.lods.size(); i++)
+            std::cout << "LOD #" << i << ": " << meshLods.lods[i].indexCount / 3 << " triangles, error " << meshLods.lods[i].error << "\n";
+    }
+}
+
+void ShadedCubeApp::createScene() {
+    NodeHandle cube = sceneGraph.addNode(INVALID_NODE);
+    objectNodes.push_back(cube);
+
+    // Any further objects are laid out on a grid below the cube
+    if (config.objectCount > 1) {
+        uint32_t gridCount = config.objectCount - 1;
+        uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(gridCount))));
+        NodeHandle grid = sceneGraph.addNode(INVALID_NODE, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -2.0f)));
+        for(uint32_t i = 0; i < gridCount; i++) {
+            glm::vec3 position(
+                (static_cast<float>(i % side) - 0.5f * side) * OBJECT_GRID_SPACING,
+                (static_cast<float>(i / side) - 0.5f * side) * OBJECT_GRID_SPACING,
+                0.0f
+            );
+            objectNodes.push_back(sceneGraph.addNode(grid, glm::translate(glm::mat4(1.0f), position)));
+        }
+    }
+
+    nodeObjects.assign(sceneGraph.size(), UINT32_MAX);
+    for(uint32_t object = 0; object < objectNodes.size(); object++)
+        nodeObjects[objectNodes[object]] = object;
+
+    sceneGraph.update();
+
+    objectBounds.resize(objectNodes.size());
+    objectAabbs.resize(objectNodes.size());
+    objectLods.assign(objectNodes.size(), 0);
+    for(uint32_t object = 0; object < objectNodes.size(); object++) {
+        const glm::mat4& world = sceneGraph.getWorldTransform(objectNodes[object]);
+        glm::vec3 center = glm::vec3(world * glm::vec4(meshLods.center, 1.0f));
+        objectBounds.set(object, center, meshLods.radius);
+        objectAabbs[object] = Aabb::fromSphere(center, meshLods.radius);
+    }
+    sceneBvh.build(objectAabbs, &workerPool());
+
+    assignPrograms();
+
+    uploadPending.assign(objectNodes.size(), 1);
+    pendingUploads.resize(objectNodes.size());
+    for(uint32_t object = 0; object < objectNodes.size(); object++)
+        pendingUploads[object] = object;
+}
+
+// Scattered over the cube and the grid of further objects; every fourth
+// one is a spot pointing down
+void ShadedCubeApp::createPointLights() {
+    std::mt19937 rng(5);
+    float extent = std::max(2.0f, 0.5f * std::sqrt(static_cast<float>(config.objectCount)) * OBJECT_GRID_SPACING);
+    std::uniform_real_distribution<float> horizontal(-extent, extent);
+    std::uniform_real_distribution<float> height(-2.5f, 1.0f);
+    std::uniform_real_distribution<float> range(0.5f, 1.5f);
+    std::uniform_real_distribution<float> channel(0.2f, 1.0f);
+
+    sceneLights.clear();
+    for(uint32_t i = 0; i < config.pointLightCount; i++) {
+        glm::vec3 position(horizontal(rng), horizontal(rng), height(rng));
+        PointLight light = PointLight::point(position, range(rng), glm::vec3(channel(rng), channel(rng), channel(rng)));
+        if (i % 4 == 3) {
+            light.range *= 2.0f;
+            light.spotOuterCos = 0.8f;
+            light.spotInnerCos = 0.9f;
+        }
+        sceneLights.push_back(light);
+    }
+    viewLights.resize(sceneLights.size());
+}
+
+// The cube uses the selected program. With mixed shaders the grid cycles
+// through all programs, starting from the selected one.
+void ShadedCubeApp::assignPrograms() {
+    objectPrograms.resize(objectNodes.size());
+    for(uint32_t object = 0; object < objectNodes.size(); object++) {
+        uint32_t program = config.shaderProgram;
+        if (config.mixedShaders && object > 0)
+            program = (program + object - 1) % END_OF_SHADERS;
+        objectPrograms[object] = static_cast<ShaderProgram>(program);
+    }
+
+    programObjectCounts.fill(0);
+    for(ShaderProgram program: objectPrograms)
+        programObjectCounts[program]++;
+}
+
+// The pipelines are precompiled, so switching only has to re-upload the
+// objects' program indices for the culling shader
+void ShadedCubeApp::selectShaderProgram(ShaderProgram program) {
+    config.shaderProgram = program;
+    assignPrograms();
+
+    for(uint32_t object = 0; object < objectNodes.size(); object++) {
+        if (!uploadPending[object]) {
+            uploadPending[object] = 1;
+            pendingUploads.push_back(object);
+        }
+    }
+}
+
+void ShadedCubeApp::updateScene() {
+    auto currentTime = std::chrono::high_resolution_clock::now();
+    if (animating)
+        sceneTime += std::chrono::duration<float, std::chrono::seconds::period>(currentTime - lastSceneUpdate).count();
+    lastSceneUpdate = currentTime;
+
+    sceneGraph.setLocalTransform(objectNodes[0], glm::rotate(
+        glm::mat4(1.0f),
+        sceneTime * glm::radians(90.f),
+        glm::vec3(0.0f, 0.0f, 1.0f)
+    ));
+
+    // Only the objects below a changed node get new bounds
+    sceneGraph.update();
+    movedObjects.clear();
+    for(NodeHandle node: sceneGraph.getUpdatedNodes()) {
+        uint32_t object = nodeObjects[node];
+        if (object == UINT32_MAX)
+            continue;
+
+        const glm::mat4& world = sceneGraph.getWorldTransform(node);
+        glm::vec3 center = glm::vec3(world * glm::vec4(meshLods.center, 1.0f));
+        objectBounds.set(object, center, meshLods.radius);
+        objectAabbs[object] = Aabb::fromSphere(center, meshLods.radius);
+        movedObjects.push_back(object);
+
+        if (!uploadPending[object]) {
+            uploadPending[object] = 1;
+            pendingUploads.push_back(object);
+        }
+    }
+    sceneBvh.refit(objectAabbs, movedObjects);
+}
+
 void ShadedCubeApp::createVertexBuffer() {
     // Creating and Allocating the Vertex Buffer
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+    VkDeviceSize bufferSize = sizeof(meshVertices[0]) * meshVertices.size();
     createBuffer(
         physicalDevice,
         device,
@@ -657,13 +1658,14 @@ void ShadedCubeApp::createVertexBuffer() {
     // Filling the Vertex Buffer
     void *data;
     vkMapMemory(device, vertexBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices.data(), (size_t) bufferSize);
+    memcpy(data, meshVertices.data(), (size_t) bufferSize);
     vkUnmapMemory(device, vertexBufferMemory);
 }
 
 void ShadedCubeApp::createIndexBuffer() {
     // Creating and Allocating the Index Buffer
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    // All LODs share a single Index Buffer
+    VkDeviceSize bufferSize = sizeof(meshLods.indices[0]) * meshLods.indices.size();
     createBuffer(
         physicalDevice,
         device,
@@ -676,15 +1678,81 @@ void ShadedCubeApp::createIndexBuffer() {
     // Filling the Index Buffer
     void *data;
     vkMapMemory(device, indexBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t) bufferSize);
+    memcpy(data, meshLods.indices.data(), (size_t) bufferSize);
     vkUnmapMemory(device, indexBufferMemory);
 }
 
+void ShadedCubeApp::createObjectBuffers() {
+    // Object data lives on the device, and only the objects that moved
+    // are copied in from a staging buffer each frame
+    createBuffer(
+        physicalDevice,
+        device,
+        sizeof(ObjectData) * objectNodes.size(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        objectBuffer,
+        objectBufferMemory
+    );
+    if (bindless)
+        bindlessObjectBuffer = bindlessDescriptors.addStorageBuffer(objectBuffer);
+
+    if (!gpuCulling)
+        return;
+
+    createBuffer(
+        physicalDevice,
+        device,
+        sizeof(VkDrawIndexedIndirectCommand) * objectNodes.size() * END_OF_SHADERS,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        drawCommandBuffer,
+        drawCommandBufferMemory
+    );
+    createBuffer(
+        physicalDevice,
+        device,
+        sizeof(uint32_t) * END_OF_SHADERS,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        drawCountBuffer,
+        drawCountBufferMemory
+    );
+    createBuffer(
+        physicalDevice,
+        device,
+        sizeof(uint32_t) * objectNodes.size(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        objectLodBuffer,
+        objectLodBufferMemory
+    );
+}
+
+void ShadedCubeApp::createObjectStagingBuffers() {
+    VkDeviceSize bufferSize = sizeof(ObjectData) * objectNodes.size();
+
+    objectStagingBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    objectStagingBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
+        createBuffer(
+            physicalDevice,
+            device,
+            bufferSize,
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            objectStagingBuffers[i],
+            objectStagingBuffersMemory[i]
+        );
+    }
+}
+
 void ShadedCubeApp::createUniformTransforms() {
-    VkDeviceSize bufferSize = sizeof(UniformTransformObject);
+    VkDeviceSize bufferSize = UniformTransformObject::SIZE;
 
-    uniformTransforms.resize(swapchainImages.size());
-    uniformTransformsMemory.resize(swapchainImages.size());
+    uniformTransforms.resize(MAX_FRAMES_IN_FLIGHT);
+    uniformTransformsMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -693,24 +1761,55 @@ void ShadedCubeApp::createUniformTransforms() {
     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     VkMemoryRequirements memRequirements;
 
-    for(size_t i=0; i< swapchainImages.size(); i++) {
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
         createBuffer(
             physicalDevice,
             device,
             bufferSize,
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            bindless ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
             uniformTransforms[i],
             uniformTransformsMemory[i]
         );
     }
+
+    uniformTransformsMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++)
+        vkMapMemory(device, uniformTransformsMemory[i], 0, bufferSize, 0, &uniformTransformsMapped[i]);
+    transformUniform.reset(MAX_FRAMES_IN_FLIGHT);
+
+    // Bindless reads them as storage buffers
+    bindlessTransforms.clear();
+    for(int i=0; bindless && i<MAX_FRAMES_IN_FLIGHT; i++)
+        bindlessTransforms.push_back(bindlessDescriptors.addStorageBuffer(uniformTransforms[i], 0, UniformTransformObject::SIZE));
+}
+
+// Only OBJECT_DATA_DYNAMIC writes to these, but the shader always declares
+// the block, so the descriptor has to point at something
+void ShadedCubeApp::createDrawUniforms() {
+    VkDeviceSize slotCount = objectData == OBJECT_DATA_DYNAMIC ? objectNodes.size() : 1;
+
+    drawUniforms.resize(MAX_FRAMES_IN_FLIGHT);
+    drawUniformsMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
+        createBuffer(
+            physicalDevice,
+            device,
+            drawUniformStride * slotCount,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            drawUniforms[i],
+            drawUniformsMemory[i]
+        );
+    }
 }
 
 void ShadedCubeApp::createUniformLights() {
-    VkDeviceSize bufferSize = sizeof(UniformLightObject);
+    VkDeviceSize bufferSize = UniformLightObject::SIZE;
 
-    uniformLights.resize(swapchainImages.size());
-    uniformLightsMemory.resize(swapchainImages.size());
+    uniformLights.resize(MAX_FRAMES_IN_FLIGHT);
+    uniformLightsMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -719,7 +1818,7 @@ void ShadedCubeApp::createUniformLights() {
     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     VkMemoryRequirements memRequirements;
 
-    for(size_t i=0; i< swapchainImages.size(); i++) {
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
         createBuffer(
             physicalDevice,
             device,
@@ -730,153 +1829,404 @@ void ShadedCubeApp::createUniformLights() {
             uniformLightsMemory[i]
         );
     }
+
+    uniformLightsMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++)
+        vkMapMemory(device, uniformLightsMemory[i], 0, bufferSize, 0, &uniformLightsMapped[i]);
+    lightUniform.reset(MAX_FRAMES_IN_FLIGHT);
 }
 
-void ShadedCubeApp::updateUniforms(uint32_t currentFrame) {
-    static auto startTime = std::chrono::high_resolution_clock::now();
+void ShadedCubeApp::createLightClusterBuffers() {
+    auto align = [this](VkDeviceSize size) {
+        return (size + storageBufferAlignment - 1) / storageBufferAlignment * storageBufferAlignment;
+    };
+    // Without lights, the buffers still have to hold an empty array
+    clusterOffset = align(sizeof(PointLight) * std::max<size_t>(sceneLights.size(), 1));
+    lightIndexOffset = clusterOffset + align(sizeof(LightCluster) * CLUSTER_COUNT);
+    VkDeviceSize bufferSize = lightIndexOffset + sizeof(uint32_t) * CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER;
 
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+    lightClusterBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    lightClusterBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    lightClusterBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
 
-    UniformTransformObject ubo = {};
-    ubo.model = glm::rotate(
-        glm::mat4(1.0f),
-        time * glm::radians(90.f),
-        glm::vec3(0.0f, 0.0f, 1.0f)
-    );
-    ubo.view = glm::lookAt(
-        glm::vec3(2.0f, 2.0f, 2.0f),
-        glm::vec3(0.0f, 0.0f, 0.0f),
-        glm::vec3(0.0f, 0.0f, 1.0f)
-    );
-    ubo.proj = glm::perspective(
-        glm::radians(45.0f),
-        swapchainExtent.width / (float) swapchainExtent.height,
-        0.1f,
-        10.0f
-    );
-    ubo.proj[1][1] *= -1;
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
+        createBuffer(
+            physicalDevice,
+            device,
+            bufferSize,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            lightClusterBuffers[i],
+            lightClusterBuffersMemory[i]
+        );
+        vkMapMemory(device, lightClusterBuffersMemory[i], 0, bufferSize, 0, &lightClusterBuffersMapped[i]);
+    }
+
+    // Every copy is written the first time its frame comes around
+    lightClusterFrameVersions.assign(MAX_FRAMES_IN_FLIGHT, UINT64_MAX);
+    clustersStale = true;
+}
+
+void ShadedCubeApp::createUniformCulls() {
+    if (!gpuCulling)
+        return;
+
+    uniformCulls.resize(MAX_FRAMES_IN_FLIGHT);
+    uniformCullsMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
+        createBuffer(
+            physicalDevice,
+            device,
+            UniformCullObject::SIZE,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            uniformCulls[i],
+            uniformCullsMemory[i]
+        );
+    }
 
+    uniformCullsMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++)
+        vkMapMemory(device, uniformCullsMemory[i], 0, UniformCullObject::SIZE, 0, &uniformCullsMapped[i]);
+    cullUniform.reset(MAX_FRAMES_IN_FLIGHT);
+}
+
+void ShadedCubeApp::updateUniforms(uint32_t currentFrame) {
+    // The camera doesn't move, so only a new aspect ratio changes it
+    if (swapchainExtent.width != cameraExtent.width || swapchainExtent.height != cameraExtent.height) {
+        glm::mat4 view = glm::lookAt(CAMERA_EYE, CAMERA_CENTER, CAMERA_UP);
+        glm::mat4 proj = glm::perspective(
+            glm::radians(CAMERA_FOV),
+            swapchainExtent.width / (float) swapchainExtent.height,
+            CAMERA_NEAR,
+            CAMERA_FAR
+        );
+        proj[1][1] *= -1;
+
+        transformUniform.set<TRANSFORM_VIEW>(view);
+        transformUniform.set<TRANSFORM_PROJ>(proj);
+        viewProjMatrix = proj * view;
+        cameraExtent = swapchainExtent;
+
+        lightClusters.setProjection(glm::radians(CAMERA_FOV), swapchainExtent.width / (float) swapchainExtent.height, CAMERA_NEAR, CAMERA_FAR);
+        lightUniform.set<LIGHT_CLUSTER_SLICE_SCALE>(lightClusters.getSliceScale());
+        lightUniform.set<LIGHT_CLUSTER_SLICE_BIAS>(lightClusters.getSliceBias());
+        lightUniform.set<LIGHT_CLUSTER_TILE_SCALE>(glm::vec2(
+            static_cast<float>(CLUSTER_COUNT_X) / swapchainExtent.width,
+            static_cast<float>(CLUSTER_COUNT_Y) / swapchainExtent.height
+        ));
+        clustersStale = true;
+    }
+
+    float time = sceneTime;
     glm::mat4 rotMat(1.0f);
 
-    UniformLightObject lo = {};
+    // The directions only change while the scene is animated
+    glm::vec4 lightDirs[MAX_LIGHTS];
     rotMat = glm::rotate(
         rotMat,
         rotationSpeed * time * glm::radians(-45.0f),
         glm::vec3(1.0f, 0.0f, 0.0f)
     );
-    lo.lightDirX = glm::vec3(rotMat * glm::vec4(-1.0f, -1.0f, -1.0f, 1.0f));
+    lightDirs[0] = glm::vec4(glm::vec3(rotMat * glm::vec4(-1.0f, -1.0f, -1.0f, 1.0f)), 0.0f);
     rotMat = glm::rotate(
         rotMat,
         rotationSpeed * time * glm::radians(-45.0f),
         glm::vec3(0.0f, 1.0f, 0.0f)
     );
-    lo.lightDirY = glm::vec3(rotMat * glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    lightDirs[1] = glm::vec4(glm::vec3(rotMat * glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)), 0.0f);
     rotMat = glm::rotate(
         rotMat,
         rotationSpeed * time * glm::radians(-45.0f),
         glm::vec3(0.0f, 0.0f, 1.0f)
     );
-    lo.lightDirZ = glm::vec3(rotMat * glm::vec4(0.5f, 0.0f, 0.5f, 1.0f));
-    lo.lightColor = glm::vec3(0.01f);
+    lightDirs[2] = glm::vec4(glm::vec3(rotMat * glm::vec4(0.5f, 0.0f, 0.5f, 1.0f)), 0.0f);
+    lightUniform.set<LIGHT_DIRS>(lightDirs);
+    lightUniform.set<LIGHT_COLOR>(glm::vec3(0.01f));
 
-    void *data;
-    vkMapMemory(device, uniformTransformsMemory[currentFrame], 0, sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
-    vkUnmapMemory(device, uniformTransformsMemory[currentFrame]);
-    vkMapMemory(device, uniformLightsMemory[currentFrame], 0, sizeof(lo), 0, &data);
-    memcpy(data, &lo, sizeof(lo));
-    vkUnmapMemory(device, uniformLightsMemory[currentFrame]);
+    frameStats.uploadBytes += transformUniform.flush(currentFrame, uniformTransformsMapped[currentFrame]);
+    frameStats.uploadBytes += lightUniform.flush(currentFrame, uniformLightsMapped[currentFrame]);
 }
 
-void ShadedCubeApp::createDescriptorPool() {
-    VkDescriptorPoolSize poolSize = {};
-    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSize.descriptorCount = static_cast<uint32_t>(swapchainImages.size() * 2);
+void ShadedCubeApp::updateLightClusters(uint32_t frame) {
+    // The lights circle the scene while it is animated, and the clusters
+    // move with the camera
+    if (clustersStale || (!sceneLights.empty() && clustersTime != sceneTime)) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        glm::mat4 orbit = glm::rotate(glm::mat4(1.0f), sceneTime * POINT_LIGHT_ORBIT_SPEED, glm::vec3(0.0f, 0.0f, 1.0f));
+        glm::mat4 toView = transformUniform.get().get<TRANSFORM_VIEW>() * orbit;
+        for(size_t i = 0; i < sceneLights.size(); i++) {
+            viewLights[i] = sceneLights[i];
+            viewLights[i].position = glm::vec3(toView * glm::vec4(sceneLights[i].position, 1.0f));
+            viewLights[i].direction = glm::vec3(toView * glm::vec4(sceneLights[i].direction, 0.0f));
+        }
+        lightClusters.build(viewLights, &workerPool());
+
+        auto end = std::chrono::high_resolution_clock::now();
+        frameStats.clusterMs = std::chrono::duration<double, std::milli>(end - start).count();
+        clustersTime = sceneTime;
+        clustersStale = false;
+        lightClusterVersion++;
+    }
+    frameStats.clusterLights = lightClusters.getLightIndices().size();
 
-    VkDescriptorPoolCreateInfo poolInfo = {};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 1;
-    poolInfo.pPoolSizes = &poolSize;
-    poolInfo.maxSets = static_cast<uint32_t>(swapchainImages.size() * 2);
+    if (lightClusterFrameVersions[frame] == lightClusterVersion)
+        return;
 
-    handleVkResult(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool), "Failed to create descriptor pool!");
+    char *data = static_cast<char *>(lightClusterBuffersMapped[frame]);
+    const auto& clusters = lightClusters.getClusters();
+    const auto& indices = lightClusters.getLightIndices();
+    if (!viewLights.empty())
+        memcpy(data, viewLights.data(), sizeof(PointLight) * viewLights.size());
+    memcpy(data + clusterOffset, clusters.data(), sizeof(LightCluster) * clusters.size());
+    memcpy(data + lightIndexOffset, indices.data(), sizeof(uint32_t) * indices.size());
+    frameStats.uploadBytes += sizeof(PointLight) * viewLights.size() + sizeof(LightCluster) * clusters.size() + sizeof(uint32_t) * indices.size();
+    lightClusterFrameVersions[frame] = lightClusterVersion;
 }
 
-void ShadedCubeApp::createDescriptorSets() {
-    descriptorSetLayouts.resize(swapchainImages.size());
+void ShadedCubeApp::updateCullUniforms(uint32_t currentFrame) {
+    Frustum frustum = extractFrustum(viewProjMatrix);
+    cullUniform.set<CULL_FRUSTUM_PLANES>(frustum.planes);
+    cullUniform.set<CULL_HIZ_VIEW_PROJ>(hiZViewProj);
+    cullUniform.set<CULL_HIZ_SIZE>(glm::vec2(hiZExtent.width, hiZExtent.height));
+    cullUniform.set<CULL_OBJECT_COUNT>(static_cast<uint32_t>(objectNodes.size()));
+    cullUniform.set<CULL_OCCLUSION_ENABLED>(occlusionCulling && hiZValid);
+    cullUniform.set<CULL_HIZ_LEVELS>(hiZLevels);
+
+    // The shader picks each object's level like selectLod does
+    float lodThresholds[MAX_LOD_LEVELS] = {};
+    uint32_t lodFirstIndices[MAX_LOD_LEVELS] = {};
+    uint32_t lodIndexCounts[MAX_LOD_LEVELS] = {};
+    for(uint32_t level = 0; level < meshLods.lods.size(); level++) {
+        lodThresholds[level] = lodSelector.threshold(level);
+        lodFirstIndices[level] = meshLods.lods[level].firstIndex;
+        lodIndexCounts[level] = meshLods.lods[level].indexCount;
+    }
+    cullUniform.set<CULL_EYE>(CAMERA_EYE);
+    cullUniform.set<CULL_LOD_SCALE>(swapchainExtent.height / std::tan(glm::radians(CAMERA_FOV) * 0.5f));
+    cullUniform.set<CULL_LOD_HYSTERESIS>(lodSelector.getHysteresis());
+    cullUniform.set<CULL_LOD_COUNT>(static_cast<uint32_t>(meshLods.lods.size()));
+    cullUniform.set<CULL_LOD_THRESHOLDS>(lodThresholds);
+    cullUniform.set<CULL_LOD_FIRST_INDICES>(lodFirstIndices);
+    cullUniform.set<CULL_LOD_INDEX_COUNTS>(lodIndexCounts);
+
+    // The camera stands still, so the block only changes with the window's
+    // size or the Hi-Z pyramid's state; most frames write nothing
+    frameStats.uploadBytes += cullUniform.flush(currentFrame, uniformCullsMapped[currentFrame]);
+}
 
-    std::vector<VkDescriptorSetLayout> vertexLayouts(swapchainImages.size(), descriptorSetLayouts[0]);
-    std::vector<VkDescriptorSetLayout> fragmentLayouts(swapchainImages.size(), descriptorSetLayouts[1]);
-    std::vector<VkDescriptorSet> transformDescriptorSets(swapchainImages.size());
-    std::vector<VkDescriptorSet> lightDescriptorSets(swapchainImages.size());
+// Picks the level an object is drawn with from its own projected size, so
+// distant objects get coarser levels than near ones
+uint32_t ShadedCubeApp::selectLod(uint32_t object, float distance) {
+    float screenSize = projectedSize(
+        objectBounds.radius[object],
+        distance,
+        glm::radians(CAMERA_FOV),
+        static_cast<float>(swapchainExtent.height)
+    );
 
-    VkDescriptorSetAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(swapchainImages.size());
-    allocInfo.pSetLayouts = vertexLayouts.data();
+    uint32_t lod = lodSelector.select(screenSize, objectLods[object], static_cast<uint32_t>(meshLods.lods.size()));
+    objectLods[object] = static_cast<uint8_t>(lod);
+    return lod;
+}
 
-    handleVkResult(vkAllocateDescriptorSets(device, &allocInfo, transformDescriptorSets.data()), "Failed to allocate descriptor sets!");
+void ShadedCubeApp::cullObjects() {
+    // Small scenes are cheaper to test exhaustively
+    Frustum frustum = extractFrustum(viewProjMatrix);
+    if (objectBounds.size() >= BVH_CULLING_THRESHOLD)
+        sceneBvh.cullFrustum(frustum, visibleObjects);
+    else
+        cullBounds(objectBounds, frustum, visibleObjects, cullScratch, &workerPool());
+}
 
-    for(size_t i=0; i<swapchainImages.size(); i++) {
-        VkDescriptorBufferInfo bufferInfo = {};
-        bufferInfo.buffer = uniformTransforms[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformTransformObject);
+void ShadedCubeApp::buildDrawList() {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // All objects share the one mesh and the per-frame descriptor sets, so
+    // for now the keys only tell pipelines, LOD levels and depths apart
+    drawItems.resize(visibleObjects.size());
+    workerPool().parallelFor(visibleObjects.size(), DRAW_SORT_CHUNK_SIZE, [&](size_t begin, size_t end, size_t) {
+        for(size_t i = begin; i < end; i++) {
+            uint32_t object = visibleObjects[i];
+            glm::vec3 center(objectBounds.centerX[object], objectBounds.centerY[object], objectBounds.centerZ[object]);
+            float distance = glm::length(center - CAMERA_EYE);
+            drawItems[i].key = makeDrawKey(objectPrograms[object], 0, 0, selectLod(object, distance), distance);
+            drawItems[i].object = object;
+        }
+    });
+    sortDraws(drawItems, drawScratch, &workerPool());
 
-        VkWriteDescriptorSet descriptorWrite = {};
-        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = transformDescriptorSets[i];
-        descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
-        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrite.descriptorCount = 1;
-        descriptorWrite.pBufferInfo = &bufferInfo;
+    auto end = std::chrono::high_resolution_clock::now();
+    frameStats.sortMs = std::chrono::duration<double, std::milli>(end - start).count();
+}
 
-        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
-    }
+// Input is only timed from the first event a frame reacts to, so a burst of
+// events counts once
+void ShadedCubeApp::noteInput() {
+    if (!pendingInput)
+        pendingInput = std::chrono::high_resolution_clock::now();
+    requestRedraw();
+}
 
-    allocInfo.pSetLayouts = fragmentLayouts.data();
+void ShadedCubeApp::requestRedraw() {
+    // Occlusion culling tests against the previous frame's depth, so the
+    // frame after a change has to be drawn as well
+    redrawFrames = occlusionCulling ? 2 : 1;
+}
 
-    handleVkResult(vkAllocateDescriptorSets(device, &allocInfo, lightDescriptorSets.data()), "Failed to allocate descriptor sets!");
+bool ShadedCubeApp::redrawNeeded() {
+    // Objects drawn with the fallback pipeline are drawn again once their
+    // own pipeline is built
+    return redrawFrames > 0 || animating || frameStats.fallbackPrograms > 0 || (shaderWatcher && shaderWatcher->hasCompiled());
+}
 
-    for(size_t i=0; i<swapchainImages.size(); i++) {
-        VkDescriptorBufferInfo bufferInfo = {};
-        bufferInfo.buffer = uniformLights[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformLightObject);
+void ShadedCubeApp::pickObject(double cursorX, double cursorY) {
+    int width, height;
+    window->getWindowSize(&width, &height);
+    if (width == 0 || height == 0)
+        return;
 
-        VkWriteDescriptorSet descriptorWrite = {};
-        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = lightDescriptorSets[i];
-        descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
-        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrite.descriptorCount = 1;
-        descriptorWrite.pBufferInfo = &bufferInfo;
+    // Unproject the cursor onto the near and far planes
+    float x = 2.0f * static_cast<float>(cursorX) / width - 1.0f;
+    float y = 2.0f * static_cast<float>(cursorY) / height - 1.0f;
+    glm::mat4 invViewProj = glm::inverse(viewProjMatrix);
+    glm::vec4 nearPoint = invViewProj * glm::vec4(x, y, -1.0f, 1.0f);
+    glm::vec4 farPoint = invViewProj * glm::vec4(x, y, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+    uint32_t object;
+    float distance;
+    if (sceneBvh.raycast(origin, glm::normalize(direction), glm::length(direction), &object, &distance))
+        std::cout << "Picked object #" << object << " at distance " << distance << "\n";
+}
 
-        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+void ShadedCubeApp::createDescriptorPool() {
+    uint32_t frameCount = MAX_FRAMES_IN_FLIGHT;
+    // The bindless set is shared by all frames and has its own pool
+    uint32_t firstSet = bindless ? 1 : 0;
+
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for(uint32_t set = firstSet; set < descriptorSetLayouts.size(); set++)
+        graphicsLayout.addPoolSizes(set, frameCount, poolSizes);
+    descriptorAllocator.create(device, static_cast<uint32_t>(descriptorSetLayouts.size() - firstSet) * frameCount, poolSizes);
+
+    if (!gpuCulling && !config.deferred)
+        return;
+
+    // Sized for the current swapchain; the allocator grows if a recreated
+    // one needs more pyramid levels
+    uint32_t cullSetCount = gpuCulling ? frameCount : 0;
+    uint32_t hiZSetCount = occlusionCulling ? hiZLevels : 0;
+    uint32_t lightingSetCount = config.deferred ? 1 : 0;
+    std::vector<VkDescriptorPoolSize> swapchainPoolSizes;
+    cullLayout.addPoolSizes(0, cullSetCount, swapchainPoolSizes);
+    hiZLayout.addPoolSizes(0, hiZSetCount, swapchainPoolSizes);
+    lightingLayout.addPoolSizes(0, lightingSetCount, swapchainPoolSizes);
+    swapchainDescriptorAllocator.create(device, cullSetCount + hiZSetCount + lightingSetCount, swapchainPoolSizes);
+}
+
+void ShadedCubeApp::createDescriptorSets() {
+    uint32_t setCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+    uint32_t firstSet = bindless ? 1 : 0;
+    std::vector<VkDescriptorSetLayout> layouts(descriptorSetLayouts.begin() + firstSet, descriptorSetLayouts.end());
+    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
+        descriptorSets[i].resize(setCount);
+        if (bindless)
+            descriptorSets[i][0] = bindlessDescriptors.getSet();
+
+        descriptorAllocator.allocate(layouts, descriptorSets[i].data() + firstSet);
+
+        // Indexed by set, then by binding; bindings the shaders don't use
+        // are skipped
+        std::vector<std::vector<DescriptorInfo>> descriptorInfos = {
+            {
+                DescriptorInfo(uniformTransforms[i], 0, graphicsLayout.getUniformSize(0, 0)),
+                DescriptorInfo(objectBuffer, 0, VK_WHOLE_SIZE)
+            },
+            {
+                DescriptorInfo(uniformLights[i], 0, graphicsLayout.getUniformSize(1, 0)),
+                DescriptorInfo(lightClusterBuffers[i], 0, clusterOffset),
+                DescriptorInfo(lightClusterBuffers[i], clusterOffset, lightIndexOffset - clusterOffset),
+                DescriptorInfo(lightClusterBuffers[i], lightIndexOffset, VK_WHOLE_SIZE)
+            },
+            {DescriptorInfo(drawUniforms[i], 0, graphicsLayout.getUniformSize(2, 0))}
+        };
+        for(uint32_t set = firstSet; set < setCount && set < descriptorInfos.size(); set++)
+            graphicsLayout.updateDescriptorSet(device, set, updateTemplates[set], descriptorSets[i][set], descriptorInfos[set]);
     }
+}
 
-    for(size_t i=0; i<swapchainImages.size(); i++) {
-        descriptorSets.push_back({transformDescriptorSets[i], lightDescriptorSets[i]});
+void ShadedCubeApp::createComputeDescriptorSets() {
+    if (!gpuCulling)
+        return;
+
+    // The culling shader reads the pyramid, so these are recreated with
+    // the swapchain
+    cullDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    swapchainDescriptorAllocator.allocate(std::vector<VkDescriptorSetLayout>(MAX_FRAMES_IN_FLIGHT, cullSetLayout), cullDescriptorSets.data());
+
+    for(int i=0; i<MAX_FRAMES_IN_FLIGHT; i++) {
+        cullLayout.updateDescriptorSet(device, 0, cullUpdateTemplate, cullDescriptorSets[i], {
+            DescriptorInfo(uniformCulls[i], 0, cullLayout.getUniformSize(0, 0)),
+            DescriptorInfo(objectBuffer, 0, VK_WHOLE_SIZE),
+            DescriptorInfo(drawCommandBuffer, 0, VK_WHOLE_SIZE),
+            DescriptorInfo(drawCountBuffer, 0, VK_WHOLE_SIZE),
+            DescriptorInfo(hiZSampler, hiZImageView, VK_IMAGE_LAYOUT_GENERAL),
+            DescriptorInfo(objectLodBuffer, 0, VK_WHOLE_SIZE)
+        });
+    }
+
+    if (!occlusionCulling)
+        return;
+
+    // Every level is reduced from the one above it, and the first one
+    // from the depth buffer
+    hiZDescriptorSets.resize(hiZLevels);
+    swapchainDescriptorAllocator.allocate(std::vector<VkDescriptorSetLayout>(hiZLevels, hiZSetLayout), hiZDescriptorSets.data());
+
+    for(uint32_t level = 0; level < hiZLevels; level++) {
+        VkImageView sourceView = level == 0 ? depthImageView : hiZMipViews[level - 1];
+        VkImageLayout sourceLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+        hiZLayout.updateDescriptorSet(device, 0, hiZUpdateTemplate, hiZDescriptorSets[level], {
+            DescriptorInfo(hiZSampler, sourceView, sourceLayout),
+            DescriptorInfo(VK_NULL_HANDLE, hiZMipViews[level], VK_IMAGE_LAYOUT_GENERAL)
+        });
     }
 }
 
+void ShadedCubeApp::createLightingDescriptorSet() {
+    if (!config.deferred)
+        return;
+
+    // Points at the G-buffer and depth images, so it is recreated with the
+    // swapchain. Every frame shares it, as they share the images.
+    swapchainDescriptorAllocator.allocate({lightingSetLayouts[0]}, &lightingDescriptorSet);
+    lightingLayout.updateDescriptorSet(device, 0, lightingUpdateTemplate, lightingDescriptorSet, {
+        DescriptorInfo(VK_NULL_HANDLE, gBufferColorView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+        DescriptorInfo(VK_NULL_HANDLE, gBufferNormalsView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+        DescriptorInfo(VK_NULL_HANDLE, depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
+    });
+}
+
 void ShadedCubeApp::createCommandPool() {
     auto queueFamilyIndices = findQueueFamilyIndices(physicalDevice);
 
     VkCommandPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsQueue.value();
-    poolInfo.flags = 0;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     handleVkResult(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool), "Failed to create command pool!");
 }
 
 void ShadedCubeApp::createCommandBuffers() {
-    commandBuffers.resize(swapchainFramebuffers.size());
+    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
     VkCommandBufferAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -885,85 +2235,509 @@ void ShadedCubeApp::createCommandBuffers() {
     allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
 
     handleVkResult(vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()), "Failed to allocate command buffers!");
+}
+
+void ShadedCubeApp::recordCommandBuffer(uint32_t frame, uint32_t imageIndex) {
+    // Command buffers are re-recorded every frame, since the objects'
+    // LOD levels can change from one frame to the next
+    VkCommandBuffer commandBuffer = commandBuffers[frame];
 
-    for(size_t i = 0; i < commandBuffers.size(); i++) {
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = 0;
-        beginInfo.pInheritanceInfo = nullptr;
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr;
+
+    handleVkResult(vkBeginCommandBuffer(commandBuffer, &beginInfo),"Failed to begin recording command buffer!");
+
+    if (programQueriesEnabled) {
+        vkCmdResetQueryPool(commandBuffer, timestampQueryPool, frame * END_OF_SHADERS * 2, END_OF_SHADERS * 2);
+        if (fragmentStatisticsSupported)
+            vkCmdResetQueryPool(commandBuffer, statisticsQueryPool, frame * END_OF_SHADERS, END_OF_SHADERS);
+        programQueriesWritten[frame] = 0;
+    }
 
-        handleVkResult(vkBeginCommandBuffer(commandBuffers[i], &beginInfo),"Failed to begin recording command buffer!");
+    recordObjectUploads(commandBuffer, frame);
+    if (gpuCulling)
+        recordCulling(commandBuffer, frame);
+
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = swapchainFramebuffers[imageIndex];
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = swapchainExtent;
+
+    // The G-buffer is cleared to black and unlit
+    std::array<VkClearValue, 4> clearValues = {};
+    clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
+    clearValues[1].depthStencil = {1.0f, 0};
+    clearValues[2].color = {0.0f, 0.0f, 0.0f, 0.0f};
+    clearValues[3].color = {0.0f, 0.0f, 0.0f, 0.0f};
+    renderPassInfo.clearValueCount = config.deferred ? 4 : 2;
+    renderPassInfo.pClearValues = clearValues.data();
+
+    VkBuffer vertexBuffers[] = {vertexBuffer};
+    VkDeviceSize offsets[] = {0};
+
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    VkViewport viewport = {0.0f, 0.0f, (float) swapchainExtent.width, (float) swapchainExtent.height, 0.0f, 1.0f};
+    VkRect2D scissor = {{0, 0}, swapchainExtent};
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    // The vertex shader declares every per-draw source whichever one it was
+    // specialized for, so the unused ones still need valid contents
+    glm::mat4 identity(1.0f);
+    uint32_t dynamicOffsetCount = graphicsLayout.getDynamicOffsetCount();
+    std::array<uint32_t, 1> dynamicOffset = {0};
+    if (dynamicOffsetCount > dynamicOffset.size())
+        throw std::runtime_error("Graphics shaders use more dynamic buffers than are bound!");
+    if (bindless) {
+        // The bindless shader finds its buffers through these indices
+        std::array<uint32_t, 2> bufferIndices = {bindlessTransforms[frame], bindlessObjectBuffer};
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(bufferIndices), bufferIndices.data());
+    } else if (objectData != OBJECT_DATA_PUSH)
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &identity);
+
+    // The object index goes through firstInstance, so the vertex shader
+    // can find its transform with gl_InstanceIndex
+    if (gpuCulling) {
+        // The culling pass writes each pipeline's draws into its own
+        // section of the draw buffer
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorSets[frame].size()), descriptorSets[frame].data(), dynamicOffsetCount, dynamicOffset.data());
+        frameStats.vertexBufferBinds++;
+        frameStats.descriptorSetBinds++;
+
+        uint32_t maxDrawCount = static_cast<uint32_t>(objectNodes.size());
+        for(uint32_t program = 0; program < END_OF_SHADERS; program++) {
+            if (programObjectCounts[program] == 0)
+                continue;
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelines[program]);
+            frameStats.pipelineBinds++;
+            beginProgramQueries(commandBuffer, frame, program);
+
+            VkDeviceSize drawOffset = sizeof(VkDrawIndexedIndirectCommand) * maxDrawCount * program;
+            if (drawIndirectCountSupported)
+                vkCmdDrawIndexedIndirectCount(commandBuffer, drawCommandBuffer, drawOffset, drawCountBuffer, sizeof(uint32_t) * program, maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+            else
+                vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffer, drawOffset, maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+            frameStats.draws++;
+
+            endProgramQueries(commandBuffer, frame, program);
+        }
+    } else {
+        // Draws come sorted by their state, so only changes need binding
+        uint32_t boundPipeline = UINT32_MAX;
+        uint32_t boundDescriptorSet = UINT32_MAX;
+        uint32_t boundMesh = UINT32_MAX;
+
+        char *drawData = nullptr;
+        if (objectData == OBJECT_DATA_DYNAMIC && !drawItems.empty())
+            vkMapMemory(device, drawUniformsMemory[frame], 0, drawUniformStride * drawItems.size(), 0, reinterpret_cast<void **>(&drawData));
+
+        for(size_t i = 0; i < drawItems.size(); i++) {
+            const DrawItem& draw = drawItems[i];
+            uint32_t pipeline = drawKeyPipeline(draw.key);
+            if (pipeline != boundPipeline) {
+                if (boundPipeline != UINT32_MAX)
+                    endProgramQueries(commandBuffer, frame, boundPipeline);
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelines[pipeline]);
+                boundPipeline = pipeline;
+                frameStats.pipelineBinds++;
+                beginProgramQueries(commandBuffer, frame, pipeline);
+            }
 
-        VkRenderPassBeginInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = swapchainFramebuffers[i];
-        renderPassInfo.renderArea.offset = {0, 0};
-        renderPassInfo.renderArea.extent = swapchainExtent;
+            // Every pipeline shares pipelineLayout, so bound sets stay
+            // valid across pipeline changes
+            uint32_t descriptorSet = drawKeyDescriptorSet(draw.key);
+            if (descriptorSet != boundDescriptorSet) {
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorSets[frame].size()), descriptorSets[frame].data(), dynamicOffsetCount, dynamicOffset.data());
+                boundDescriptorSet = descriptorSet;
+                frameStats.descriptorSetBinds++;
+            }
 
-        VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
-        renderPassInfo.clearValueCount = 1;
-        renderPassInfo.pClearValues = &clearColor;
+            uint32_t mesh = drawKeyMesh(draw.key);
+            if (mesh != boundMesh) {
+                vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+                vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+                boundMesh = mesh;
+                frameStats.vertexBufferBinds++;
+            }
 
-        vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-        VkBuffer vertexBuffers[] = {vertexBuffer};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-        vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 2, descriptorSets[i].data(), 0, nullptr);
-        vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-        vkCmdEndRenderPass(commandBuffers[i]);
+            if (objectData == OBJECT_DATA_PUSH) {
+                const glm::mat4& model = sceneGraph.getWorldTransform(objectNodes[draw.object]);
+                vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &model);
+                frameStats.pushConstantUpdates++;
+            } else if (objectData == OBJECT_DATA_DYNAMIC) {
+                uint32_t offset = static_cast<uint32_t>(i * drawUniformStride);
+                memcpy(drawData + offset, &sceneGraph.getWorldTransform(objectNodes[draw.object]), sizeof(glm::mat4));
+                frameStats.uploadBytes += sizeof(glm::mat4);
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &descriptorSets[frame][2], 1, &offset);
+                frameStats.descriptorSetBinds++;
+            }
 
-        handleVkResult(vkEndCommandBuffer(commandBuffers[i]), "Failed to record command buffer!");
+            // Every level indexes the same vertices, so only the index
+            // range changes with it
+            const MeshLod& lod = meshLods.lods[drawKeyLod(draw.key)];
+            vkCmdDrawIndexed(commandBuffer, lod.indexCount, 1, lod.firstIndex, 0, draw.object);
+            frameStats.draws++;
+        }
+        if (drawData != nullptr)
+            vkUnmapMemory(device, drawUniformsMemory[frame]);
+        if (boundPipeline != UINT32_MAX)
+            endProgramQueries(commandBuffer, frame, boundPipeline);
     }
+    if (config.deferred)
+        recordLighting(commandBuffer, frame);
+    vkCmdEndRenderPass(commandBuffer);
+
+    if (occlusionCulling)
+        recordHiZBuild(commandBuffer);
+
+    handleVkResult(vkEndCommandBuffer(commandBuffer), "Failed to record command buffer!");
 }
 
+// Shades every pixel once, from what the geometry subpass left in the
+// G-buffer there
+void ShadedCubeApp::recordLighting(VkCommandBuffer commandBuffer, uint32_t frame) {
+    vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, lightingPipeline);
+    std::array<VkDescriptorSet, 2> sets = {lightingDescriptorSet, descriptorSets[frame][1]};
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, lightingPipelineLayout, 0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+    frameStats.pipelineBinds++;
+    frameStats.descriptorSetBinds++;
+
+    glm::mat4 proj = transformUniform.get().get<TRANSFORM_PROJ>();
+    LightingConstants constants = {};
+    constants.unproject = glm::vec4(1.0f / proj[0][0], 1.0f / proj[1][1], proj[2][2], proj[3][2]);
+    constants.pixelToNdc = glm::vec2(2.0f / swapchainExtent.width, 2.0f / swapchainExtent.height);
+    constants.lightCount = config.lightCount;
+    vkCmdPushConstants(commandBuffer, lightingPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+
+    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    frameStats.draws++;
+}
 
-void ShadedCubeApp::cleanupSwapchain() {
-    for(auto framebuffer : swapchainFramebuffers)
-        vkDestroyFramebuffer(device, framebuffer, nullptr);
+void ShadedCubeApp::createQueryPools() {
+    if (!programQueriesEnabled)
+        return;
 
-    for(size_t i=0; i<swapchainImages.size(); i++) {
-        vkDestroyBuffer(device, uniformLights[i], nullptr);
-        vkFreeMemory(device, uniformLightsMemory[i], nullptr);
-        vkDestroyBuffer(device, uniformTransforms[i], nullptr);
-        vkFreeMemory(device, uniformTransformsMemory[i], nullptr);
+    uint32_t frameCount = MAX_FRAMES_IN_FLIGHT;
+    programQueriesWritten.assign(frameCount, 0);
+
+    VkQueryPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = frameCount * END_OF_SHADERS * 2;
+
+    handleVkResult(vkCreateQueryPool(device, &poolInfo, nullptr, &timestampQueryPool), "Failed to create query pool!");
+
+    if (!fragmentStatisticsSupported)
+        return;
+
+    poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    poolInfo.queryCount = frameCount * END_OF_SHADERS;
+    poolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    handleVkResult(vkCreateQueryPool(device, &poolInfo, nullptr, &statisticsQueryPool), "Failed to create query pool!");
+}
+
+// Both timestamps wait for all earlier work to finish, so with one program
+// drawn after another their difference is the time spent on that program
+void ShadedCubeApp::beginProgramQueries(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t program) {
+    if (!programQueriesEnabled)
+        return;
+
+    uint32_t query = frame * END_OF_SHADERS + program;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, query * 2);
+    if (fragmentStatisticsSupported)
+        vkCmdBeginQuery(commandBuffer, statisticsQueryPool, query, 0);
+}
+
+void ShadedCubeApp::endProgramQueries(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t program) {
+    if (!programQueriesEnabled)
+        return;
+
+    uint32_t query = frame * END_OF_SHADERS + program;
+    if (fragmentStatisticsSupported)
+        vkCmdEndQuery(commandBuffer, statisticsQueryPool, query);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, query * 2 + 1);
+    programQueriesWritten[frame] |= 1u << program;
+}
+
+// Called once the image's previous submission has finished, so its
+// results are available without waiting
+void ShadedCubeApp::readProgramQueries(uint32_t frame) {
+    if (!programQueriesEnabled)
+        return;
+
+    frameStats.programs.resize(END_OF_SHADERS);
+    for(uint32_t program = 0; program < END_OF_SHADERS; program++) {
+        if (!(programQueriesWritten[frame] & (1u << program)))
+            continue;
+
+        uint32_t query = frame * END_OF_SHADERS + program;
+        uint64_t timestamps[2];
+        if (vkGetQueryPoolResults(device, timestampQueryPool, query * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+            continue;
+
+        ProgramStats& stats = frameStats.programs[program];
+        stats.samples = 1;
+        stats.gpuMs = (timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+        if (fragmentStatisticsSupported)
+            vkGetQueryPoolResults(device, statisticsQueryPool, query, 1, sizeof(stats.fragments), &stats.fragments, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
     }
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+}
+
+void ShadedCubeApp::recordObjectUploads(VkCommandBuffer commandBuffer, uint32_t frame) {
+    if (pendingUploads.empty())
+        return;
+
+    void *data;
+    vkMapMemory(device, objectStagingBuffersMemory[frame], 0, sizeof(ObjectData) * pendingUploads.size(), 0, &data);
+    ObjectData *staged = reinterpret_cast<ObjectData *>(data);
+
+    // Runs of consecutive objects are merged into a single copy region
+    objectCopies.clear();
+    for(size_t i = 0; i < pendingUploads.size(); i++) {
+        uint32_t object = pendingUploads[i];
+        staged[i].model = sceneGraph.getWorldTransform(objectNodes[object]);
+        staged[i].boundingSphere = glm::vec4(
+            objectBounds.centerX[object],
+            objectBounds.centerY[object],
+            objectBounds.centerZ[object],
+            objectBounds.radius[object]
+        );
+        staged[i].program = objectPrograms[object];
+        uploadPending[object] = 0;
+
+        VkDeviceSize srcOffset = sizeof(ObjectData) * i;
+        VkDeviceSize dstOffset = sizeof(ObjectData) * object;
+        if (!objectCopies.empty() &&
+            objectCopies.back().srcOffset + objectCopies.back().size == srcOffset &&
+            objectCopies.back().dstOffset + objectCopies.back().size == dstOffset)
+            objectCopies.back().size += sizeof(ObjectData);
+        else
+            objectCopies.push_back({srcOffset, dstOffset, sizeof(ObjectData)});
+    }
+    vkUnmapMemory(device, objectStagingBuffersMemory[frame]);
+    frameStats.uploadBytes += sizeof(ObjectData) * pendingUploads.size();
+    pendingUploads.clear();
+
+    VkPipelineStageFlags readStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+    if (gpuCulling)
+        readStages |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    // Earlier frames may still be reading the object buffer
+    vkCmdPipelineBarrier(commandBuffer, readStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+    vkCmdCopyBuffer(commandBuffer, objectStagingBuffers[frame], objectBuffer, static_cast<uint32_t>(objectCopies.size()), objectCopies.data());
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, readStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void ShadedCubeApp::recordCulling(VkCommandBuffer commandBuffer, uint32_t frame) {
+    uint32_t objectCount = static_cast<uint32_t>(objectNodes.size());
+
+    // The previous frame's draws have to be done with the draw buffers
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+    vkCmdFillBuffer(commandBuffer, drawCountBuffer, 0, VK_WHOLE_SIZE, 0);
+    // Without a GPU-side draw count every slot gets drawn, so the ones
+    // past the last visible object have to be empty draws
+    if (!drawIndirectCountSupported)
+        vkCmdFillBuffer(commandBuffer, drawCommandBuffer, 0, VK_WHOLE_SIZE, 0);
+    // Every object starts out at the finest level
+    if (!objectLodsCleared) {
+        vkCmdFillBuffer(commandBuffer, objectLodBuffer, 0, VK_WHOLE_SIZE, 0);
+        objectLodsCleared = true;
+    }
+
+    // Also orders the previous frame's LOD writes before this frame reads
+    // them back
+    VkMemoryBarrier clearBarrier = {};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    // The pyramid has to be in its shader layout even before it is first built
+    VkImageMemoryBarrier hiZBarrier = {};
+    hiZBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    hiZBarrier.srcAccessMask = 0;
+    hiZBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    hiZBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    hiZBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    hiZBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hiZBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hiZBarrier.image = hiZImage;
+    hiZBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, hiZLevels, 0, 1};
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        1, &clearBarrier,
+        0, nullptr,
+        hiZValid ? 0 : 1, &hiZBarrier
+    );
 
-    vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-    vkDestroyPipeline(device, graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-    vkDestroyRenderPass(device, renderPass, nullptr);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSets[frame], 0, nullptr);
+    vkCmdDispatch(commandBuffer, (objectCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
 
-    for(auto imageView : swapchainImageViews)
+    VkMemoryBarrier drawBarrier = {};
+    drawBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &drawBarrier, 0, nullptr, 0, nullptr);
+}
+
+void ShadedCubeApp::recordHiZBuild(VkCommandBuffer commandBuffer) {
+    // This frame's culling has already read the old pyramid, so its
+    // contents can be discarded
+    VkImageMemoryBarrier hiZBarrier = {};
+    hiZBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    hiZBarrier.srcAccessMask = 0;
+    hiZBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    hiZBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    hiZBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    hiZBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hiZBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hiZBarrier.image = hiZImage;
+    hiZBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, hiZLevels, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &hiZBarrier);
+
+    // Each level reads the one written before it. The last barrier makes
+    // the finished pyramid visible to the next frame's culling.
+    VkMemoryBarrier levelBarrier = {};
+    levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZPipeline);
+    for(uint32_t level = 0; level < hiZLevels; level++) {
+        uint32_t width = std::max(hiZExtent.width >> level, 1u);
+        uint32_t height = std::max(hiZExtent.height >> level, 1u);
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZPipelineLayout, 0, 1, &hiZDescriptorSets[level], 0, nullptr);
+        vkCmdDispatch(commandBuffer, (width + HIZ_WORKGROUP_SIZE - 1) / HIZ_WORKGROUP_SIZE, (height + HIZ_WORKGROUP_SIZE - 1) / HIZ_WORKGROUP_SIZE, 1);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &levelBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    hiZValid = true;
+    hiZViewProj = viewProjMatrix;
+}
+
+
+// Only what depends on the window's size or the swapchain's images; the
+// per-frame resources, pipelines and everything else outlive it
+void ShadedCubeApp::cleanupSwapchain() {
+    // Frames still in flight may use any of this, so it is retired rather
+    // than destroyed and recreating the swapchain doesn't wait for them
+    retire([this, framebuffers = swapchainFramebuffers]() {
+        for(auto framebuffer : framebuffers)
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+    });
+
+    if (gpuCulling || config.deferred)
+        retire([this, pools = swapchainDescriptorAllocator.retire()]() { swapchainDescriptorAllocator.recycle(pools); });
+    if (gpuCulling) {
+        retire([this, sampler = hiZSampler, mipViews = hiZMipViews, imageView = hiZImageView, image = hiZImage, memory = hiZImageMemory]() {
+            vkDestroySampler(device, sampler, nullptr);
+            for(auto mipView : mipViews)
+                vkDestroyImageView(device, mipView, nullptr);
+            vkDestroyImageView(device, imageView, nullptr);
+            vkDestroyImage(device, image, nullptr);
+            vkFreeMemory(device, memory, nullptr);
+        });
+    }
+    retire([this, imageView = depthImageView, image = depthImage, memory = depthImageMemory]() {
         vkDestroyImageView(device, imageView, nullptr);
+        vkDestroyImage(device, image, nullptr);
+        vkFreeMemory(device, memory, nullptr);
+    });
+    if (config.deferred) {
+        retire([this, colorView = gBufferColorView, colorImage = gBufferColorImage, colorMemory = gBufferColorMemory,
+                normalsView = gBufferNormalsView, normalsImage = gBufferNormalsImage, normalsMemory = gBufferNormalsMemory]() {
+            vkDestroyImageView(device, colorView, nullptr);
+            vkDestroyImage(device, colorImage, nullptr);
+            vkFreeMemory(device, colorMemory, nullptr);
+            vkDestroyImageView(device, normalsView, nullptr);
+            vkDestroyImage(device, normalsImage, nullptr);
+            vkFreeMemory(device, normalsMemory, nullptr);
+        });
+    }
 
-    vkDestroySwapchainKHR(device, swapchain, nullptr);
+    // Images acquired from the old swapchain may still be waiting to be
+    // presented
+    retire([this, imageViews = swapchainImageViews, oldSwapchain = swapchain]() {
+        for(auto imageView : imageViews)
+            vkDestroyImageView(device, imageView, nullptr);
+        vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
+    });
+}
+
+void ShadedCubeApp::retireGraphicsPipelines() {
+    for(auto pipeline : pipelineLibrary.release())
+        retirePipeline(pipeline);
+    retire([this, layout = pipelineLayout, pass = renderPass]() {
+        vkDestroyPipelineLayout(device, layout, nullptr);
+        vkDestroyRenderPass(device, pass, nullptr);
+    });
+    if (config.deferred) {
+        retirePipeline(lightingPipeline);
+        retire([this, layout = lightingPipelineLayout]() { vkDestroyPipelineLayout(device, layout, nullptr); });
+    }
 }
 
 void ShadedCubeApp::recreateSwapchain() {
-    vkDeviceWaitIdle(device);
+    auto recreateStart = std::chrono::high_resolution_clock::now();
 
+    VkFormat oldFormat = swapchainImageFormat;
     cleanupSwapchain();
-
     createSwapchain();
     createImageViews();
-    createRenderPass();
-    createGraphicsPipeline();
+
+    // The render pass, and with it every pipeline, only depends on the
+    // format, which practically never changes
+    if (swapchainImageFormat != oldFormat) {
+        retireGraphicsPipelines();
+        createRenderPass();
+        createGraphicsPipeline();
+        createLightingPipeline();
+    }
+
+    createDepthResources();
+    createHiZResources();
+    createGBufferResources();
     createFramebuffers();
-    createUniformTransforms();
-    createDescriptorPool();
-    createDescriptorSets();
-    createCommandBuffers();
+    createComputeDescriptorSets();
+    createLightingDescriptorSet();
+    requestRedraw();
+
+    if (config.stats) {
+        auto recreateEnd = std::chrono::high_resolution_clock::now();
+        printf(
+            "swapchain recreated in %.2f ms | %ux%u, %zu images, %s\n",
+            std::chrono::duration<double, std::milli>(recreateEnd - recreateStart).count(),
+            swapchainExtent.width, swapchainExtent.height, swapchainImages.size(),
+            presentModeName(presentMode)
+        );
+    }
 }
 
 void ShadedCubeApp::createSyncObjects() {
    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
    renderCompleteSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-   imagesInFlight.resize(swapchainImages.size(), VK_NULL_HANDLE);
 
    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -979,10 +2753,20 @@ void ShadedCubeApp::createSyncObjects() {
 }
 
 void ShadedCubeApp::drawFrame() {
+    auto frameStart = std::chrono::high_resolution_clock::now();
+    if (redrawFrames > 0)
+        redrawFrames--;
     vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    auto fenceEnd = std::chrono::high_resolution_clock::now();
+
+    destroyRetired(false);
+    if (shaderWatcher)
+        reloadShaders();
 
     uint32_t imageIndex;
+    auto acquireStart = std::chrono::high_resolution_clock::now();
     VkResult result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+    auto acquireEnd = std::chrono::high_resolution_clock::now();
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
         recreateSwapchain();
@@ -990,12 +2774,34 @@ void ShadedCubeApp::drawFrame() {
     } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
         throw std::runtime_error("Failed to acquire Swapchain image!");
 
-    if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)
-        vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+    // This frame is the first to show the effect of any input until now
+    auto frameInput = pendingInput;
+    pendingInput.reset();
+
+    frameStats = FrameStats();
+    updateScene();
+    updateUniforms(currentFrame);
+    updateLightClusters(currentFrame);
+    frameStats.frameMs = std::chrono::duration<double, std::milli>(frameStart - lastFrameStart).count();
+    frameStats.fenceWaitMs = std::chrono::duration<double, std::milli>(fenceEnd - frameStart).count();
+    frameStats.acquireMs = std::chrono::duration<double, std::milli>(acquireEnd - acquireStart).count();
+    frameStats.limiterSleepMs = frameLimiter.getSleepMs();
+    frameStats.limiterSpinMs = frameLimiter.getSpinMs();
+    lastFrameStart = frameStart;
+    readProgramQueries(currentFrame);
+    if (gpuCulling)
+        updateCullUniforms(currentFrame);
+    else {
+        cullObjects();
+        buildDrawList();
+    }
 
-    imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+    selectPipelines();
 
-    updateUniforms(imageIndex);
+    auto recordStart = std::chrono::high_resolution_clock::now();
+    recordCommandBuffer(currentFrame, imageIndex);
+    auto recordEnd = std::chrono::high_resolution_clock::now();
+    frameStats.recordMs = std::chrono::duration<double, std::milli>(recordEnd - recordStart).count();
 
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1006,14 +2812,16 @@ void ShadedCubeApp::drawFrame() {
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+    submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
 
     VkSemaphore signalSemaphores[] = {renderCompleteSemaphores[currentFrame]};
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
     vkResetFences(device, 1, &inFlightFences[currentFrame]);
+    auto submitStart = std::chrono::high_resolution_clock::now();
     handleVkResult(vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]), "Failed to submit draw command buffer!");
+    auto submitEnd = std::chrono::high_resolution_clock::now();
 
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1026,6 +2834,19 @@ void ShadedCubeApp::drawFrame() {
     presentInfo.pImageIndices = &imageIndex;
 
     result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    auto presentEnd = std::chrono::high_resolution_clock::now();
+
+    // Without timing extensions, the CPU can only see when the frame was
+    // handed to the presentation engine, not when it was displayed
+    frameStats.submitMs = std::chrono::duration<double, std::milli>(submitEnd - submitStart).count();
+    frameStats.presentMs = std::chrono::duration<double, std::milli>(presentEnd - submitEnd).count();
+    if (frameInput) {
+        frameStats.inputs = 1;
+        frameStats.inputLatencyMs = std::chrono::duration<double, std::milli>(presentEnd - *frameInput).count();
+    }
+    if (config.stats)
+        statsReporter.addFrame(frameStats);
+
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
         framebufferResized = false;
         recreateSwapchain();
@@ -1033,5 +2854,6 @@ void ShadedCubeApp::drawFrame() {
         throw std::runtime_error("Failed to present Swapchain image!");
 
     currentFrame = (currentFrame+1) % MAX_FRAMES_IN_FLIGHT;
+    frameNumber++;
 }
 
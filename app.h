@@ -3,10 +3,30 @@
 
 #include "vulkan/include/vulkan/vulkan.h"
 #include "window.h"
+#include "mesh.h"
+#include "culling.h"
+#include "bvh.h"
+#include "scene.h"
+#include "draw_sort.h"
+#include "stats.h"
+#include "shader_watcher.h"
+#include "shader_reflection.h"
+#include "pipeline_library.h"
+#include "shader_modules.h"
+#include "bindless.h"
+#include "descriptor_allocator.h"
+#include "frame_limiter.h"
+#include "tracked_uniform.h"
+#include "uniform_layout.h"
+#include "light_clusters.h"
 
 #include <array>
+#include <chrono>
+#include <cstring>
+#include <functional>
 #include <glm/detail/type_mat.hpp>
 #include <iostream>
+#include <map>
 #include <optional>
 #include <stdexcept>
 #include <memory>
@@ -31,6 +51,58 @@ inline bool validateShaderName(ShaderProgram program, const char *shaderProgramN
     }
 }
 
+enum LightingModel {
+    LIGHTING_UNLIT,
+    LIGHTING_COOL
+};
+
+// Must match MAX_LIGHTS in shaders/uber.frag
+const uint32_t MAX_LIGHTS = 3;
+
+// Specialization constants of shaders/uber.frag that make up a ShaderProgram
+struct ShaderVariant {
+    const char *name;
+    uint32_t lightingModel;
+    uint32_t lightCount;
+    uint32_t gBuffer;           // Set per pipeline, not per program
+};
+
+// Where the vertex shader gets each draw's model matrix from; must match
+// shaders/shader.vert
+enum ObjectDataSource {
+    OBJECT_DATA_INSTANCE,   // Object buffer, indexed through firstInstance
+    OBJECT_DATA_PUSH,       // Push constants, written for every draw
+    OBJECT_DATA_DYNAMIC     // Uniform buffer, bound at a new offset for every draw
+};
+
+// How the swapchain's present mode is picked, see PRESENT_MODE_PREFERENCES
+enum PresentPolicy {
+    PRESENT_LOW_LATENCY,        // Newest frame at every vblank, without tearing
+    PRESENT_POWER_SAVING,       // Rendering waits for vblank
+    PRESENT_UNCAPPED,           // Never waits for the display, tearing if it has to
+    PRESENT_IMMEDIATE,          // Always tears; for benchmarking
+    END_OF_PRESENT_POLICIES
+};
+
+struct AppConfig {
+    ShaderProgram shaderProgram = DIFFUSE_SHADER;
+    uint32_t objectCount = 1;
+    bool sphereMesh = false;        // A subdivided sphere instead of the cube
+    bool gpuCulling = false;
+    bool occlusionCulling = false;
+    bool mixedShaders = false;
+    ObjectDataSource objectData = OBJECT_DATA_INSTANCE;
+    bool bindless = false;
+    PresentPolicy presentPolicy = PRESENT_LOW_LATENCY;
+    double targetFps = 0.0;         // 0 leaves the frame rate to the present mode
+    bool onDemand = false;          // Only draw frames that would look different
+    uint32_t lightCount = MAX_LIGHTS;
+    uint32_t pointLightCount = 0;
+    bool deferred = false;          // G-buffer and lighting subpasses
+    bool stats = false;
+    bool hotReload = false;
+};
+
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsQueue;
     std::optional<uint32_t> computeQueue;
@@ -47,58 +119,63 @@ struct SwapchainSupportDetails {
     std::vector<VkPresentModeKHR> presentModes;
 };
 
-struct Vertex {
-    glm::vec3 pos;
-    glm::vec3 color;
-    glm::vec3 normal;
-
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription bindingDescription = {};
-        bindingDescription.binding = 0;
-        bindingDescription.stride = sizeof(Vertex);
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-        return bindingDescription;
-    }
-
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
-
-        attributeDescriptions[0].binding = 0;
-        attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-        attributeDescriptions[1].binding = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, normal);
-
-        return attributeDescriptions;
-    }
+// Uniform blocks are declared as field lists, which UniformBlock packs; the
+// shaders declare their members in packed order, checked in app.cpp
+enum TransformField {
+    TRANSFORM_VIEW,
+    TRANSFORM_PROJ
 };
+typedef UniformBlock<LAYOUT_STD140, glm::mat4, glm::mat4> UniformTransformObject;
 
-struct UniformTransformObject {
+// Per-object data read by the vertex shader (indexed by gl_InstanceIndex)
+// and by the culling compute shader; std430
+struct ObjectData {
     glm::mat4 model;
-    glm::mat4 view;
-    glm::mat4 proj;
+    glm::vec4 boundingSphere;
+    uint32_t program;
+    uint32_t padding[3];
+};
+
+// The culling compute shader's uniforms
+enum CullField {
+    CULL_FRUSTUM_PLANES,
+    CULL_HIZ_VIEW_PROJ,
+    CULL_HIZ_SIZE,
+    CULL_OBJECT_COUNT,
+    CULL_OCCLUSION_ENABLED,
+    CULL_HIZ_LEVELS,
+    CULL_EYE,
+    CULL_LOD_SCALE,
+    CULL_LOD_HYSTERESIS,
+    CULL_LOD_COUNT,
+    CULL_LOD_THRESHOLDS,
+    CULL_LOD_FIRST_INDICES,
+    CULL_LOD_INDEX_COUNTS
+};
+typedef UniformBlock<LAYOUT_STD140,
+    glm::vec4[6], glm::mat4, glm::vec2, uint32_t, uint32_t, uint32_t,
+    glm::vec3, float, float, uint32_t, float[MAX_LOD_LEVELS], uint32_t[MAX_LOD_LEVELS], uint32_t[MAX_LOD_LEVELS]> UniformCullObject;
+
+// The fragment shader's lights; a scalar fills the row after lightColor
+enum LightField {
+    LIGHT_DIRS,
+    LIGHT_COLOR,
+    LIGHT_CLUSTER_TILE_SCALE,
+    LIGHT_CLUSTER_SLICE_SCALE,
+    LIGHT_CLUSTER_SLICE_BIAS
 };
+typedef UniformBlock<LAYOUT_STD140, glm::vec4[MAX_LIGHTS], glm::vec3, glm::vec2, float, float> UniformLightObject;
 
-struct UniformLightObject {
-    glm::vec3 lightDirX;
-    glm::vec3 lightDirY;
-    glm::vec3 lightDirZ;
-    glm::vec3 lightColor;
+// Push constants of shaders/deferred.frag; std430
+struct LightingConstants {
+    glm::vec4 unproject;
+    glm::vec2 pixelToNdc;
+    uint32_t lightCount;
 };
 
 class ShadedCubeApp {
     public:
-        ShadedCubeApp(ShaderProgram program);
+        ShadedCubeApp(const AppConfig& config);
         ~ShadedCubeApp();
         void run();
     private:
@@ -111,26 +188,79 @@ class ShadedCubeApp {
         void createImageViews();
         void createRenderPass();
         void createDescriptorSetLayouts();
+        ShaderLayout reflectGraphicsShaders();
+        ShaderLayout reflectLightingShaders();
         void createGraphicsPipeline();
+        void createComputePipelines();
+        void resetPipelineLibrary();
+        void precompilePipelines();
+        void selectPipelines();
+        uint32_t pipelineVariant(uint32_t program, uint32_t lightCount) const;
+        VkPipeline buildGraphicsPipeline(VkShaderModule vertShaderModule, VkShaderModule fragShaderModule, uint32_t variant, VkPipelineCache cache);
+        VkPipeline buildComputePipeline(const std::string& shaderFile, VkPipelineLayout layout);
+        void createLightingPipeline();
+        VkPipeline buildLightingPipeline(VkPipelineCache cache);
+        SpirvCode loadShaderCode(const std::string& shaderFile);
+        const std::string& vertexShaderFile() const;
+        void reloadShaders();
+        void retire(std::function<void()> destroy);
+        void retirePipeline(VkPipeline pipeline);
+        void retireBuffer(VkBuffer buffer, VkDeviceMemory memory);
+        void destroyRetired(bool all);
+        void createDepthResources();
+        void createHiZResources();
+        void createGBufferResources();
         void createFramebuffers();
+        void loadMesh();
+        void createScene();
+        void createPointLights();
+        void assignPrograms();
+        void selectShaderProgram(ShaderProgram program);
+        void updateScene();
         void createVertexBuffer();
         void createIndexBuffer();
+        void createObjectBuffers();
+        void createObjectStagingBuffers();
         void createUniformTransforms();
         void createUniformLights();
+        void createUniformCulls();
+        void createDrawUniforms();
         void updateUniforms(uint32_t currentFrame);
+        void createLightClusterBuffers();
+        void updateLightClusters(uint32_t frame);
+        void updateCullUniforms(uint32_t currentFrame);
+        uint32_t selectLod(uint32_t object, float distance);
+        void cullObjects();
+        void buildDrawList();
+        void pickObject(double cursorX, double cursorY);
+        void noteInput();
+        void requestRedraw();
+        bool redrawNeeded();
         void createDescriptorPool();
         void createDescriptorSets();
+        void createComputeDescriptorSets();
+        void createLightingDescriptorSet();
         void createCommandPool();
         void createCommandBuffers();
+        void recordCommandBuffer(uint32_t frame, uint32_t imageIndex);
+        void recordObjectUploads(VkCommandBuffer commandBuffer, uint32_t frame);
+        void recordCulling(VkCommandBuffer commandBuffer, uint32_t frame);
+        void recordHiZBuild(VkCommandBuffer commandBuffer);
+        void recordLighting(VkCommandBuffer commandBuffer, uint32_t frame);
         void cleanupSwapchain();
+        void retireGraphicsPipelines();
         void recreateSwapchain();
         void createSyncObjects();
+        void createQueryPools();
+        void beginProgramQueries(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t program);
+        void endProgramQueries(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t program);
+        void readProgramQueries(uint32_t frame);
 
         void drawFrame();
 
         VkInstance instance;
         VkDebugUtilsMessengerEXT debugMessenger;
-        ShaderProgram shaderProgram;
+        AppConfig config;
 
         Window *window;
         VkSurfaceKHR surface;
@@ -139,7 +269,8 @@ class ShadedCubeApp {
         VkDevice device;
         VkQueue graphicsQueue, computeQueue, presentQueue;
 
-        VkSwapchainKHR swapchain;
+        // Still the old one while createSwapchain() replaces it
+        VkSwapchainKHR swapchain = VK_NULL_HANDLE;
         std::vector<VkImage> swapchainImages;
         VkFormat swapchainImageFormat;
         VkExtent2D swapchainExtent;
@@ -147,21 +278,206 @@ class ShadedCubeApp {
         std::vector<VkFramebuffer> swapchainFramebuffers;
 
         VkRenderPass renderPass;
+        // Descriptor sets and push constants are reflected from the shaders
+        DescriptorSetLayoutCache setLayoutCache;
+        ShaderLayout graphicsLayout;
+        ShaderLayout cullLayout;
+        ShaderLayout hiZLayout;
+        ShaderLayout lightingLayout;
         std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
+        // Indexed by set, VK_NULL_HANDLE for sets that aren't written per frame
+        std::vector<VkDescriptorUpdateTemplate> updateTemplates;
         VkPipelineLayout pipelineLayout;
-        VkPipeline graphicsPipeline;
+        // Every program for every light count, indexed by pipelineVariant()
+        PipelineLibrary pipelineLibrary;
+        // Modules live until the device is destroyed. Shaders that hot
+        // reload replaced are kept too; going back to them is then free.
+        ShaderModuleCache shaderModules;
+        VkShaderModule vertShaderModule = VK_NULL_HANDLE;
+        VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+        // The variants the current settings draw with, one per program, or
+        // the fallback while a variant is still being built
+        std::array<VkPipeline, END_OF_SHADERS> graphicsPipelines;
+        VkPipeline fallbackPipeline = VK_NULL_HANDLE;
+
+        // Resolved against the device's features in createLogicalDevice()
+        bool gpuCulling = false;
+        bool occlusionCulling = false;
+        bool drawIndirectCountSupported = false;
+        bool bindless = false;
+        // Indirect draws can't change push constants or offsets per draw,
+        // so GPU culling always uses the object buffer, as does bindless
+        ObjectDataSource objectData = OBJECT_DATA_INSTANCE;
+        uint32_t bindlessCapacity = 0;
+
+        // With --bindless, set 0 of the graphics pipelines. The indices of
+        // the buffers in it are pushed as constants.
+        BindlessDescriptors bindlessDescriptors;
+        uint32_t bindlessObjectBuffer = 0;
+        std::vector<uint32_t> bindlessTransforms;
+
+        VkDescriptorSetLayout cullSetLayout;
+        VkDescriptorUpdateTemplate cullUpdateTemplate = VK_NULL_HANDLE;
+        VkPipelineLayout cullPipelineLayout;
+        VkPipeline cullPipeline;
+        VkDescriptorSetLayout hiZSetLayout;
+        VkDescriptorUpdateTemplate hiZUpdateTemplate = VK_NULL_HANDLE;
+        VkPipelineLayout hiZPipelineLayout;
+        VkPipeline hiZPipeline;
+
+        // The lighting subpass of --deferred. Its set 0 reads the G-buffer;
+        // set 1 is the graphics pipelines' light set, bound as is.
+        std::array<VkDescriptorSetLayout, 2> lightingSetLayouts;
+        VkDescriptorUpdateTemplate lightingUpdateTemplate = VK_NULL_HANDLE;
+        VkPipelineLayout lightingPipelineLayout;
+        VkPipeline lightingPipeline;
+
+        std::unique_ptr<ShaderWatcher> shaderWatcher;
+        // SPIR-V compiled at runtime by the watcher, by shader file; loaded
+        // instead of the file on disk
+        std::map<std::string, std::vector<uint32_t>> reloadedShaders;
+        // Replaced objects, by the frame they were replaced on, and how to
+        // destroy them. Command buffers of earlier frames may still use them.
+        std::vector<std::pair<uint64_t, std::function<void()>>> retiredObjects;
+        uint64_t frameNumber = 0;
+
+        VkFormat depthFormat;
+        VkImage depthImage;
+        VkDeviceMemory depthImageMemory;
+        VkImageView depthImageView;
+
+        // Written and read back within the render pass of --deferred, so it
+        // is transient and, on tilers, never leaves tile memory
+        VkImage gBufferColorImage;
+        VkDeviceMemory gBufferColorMemory;
+        VkImageView gBufferColorView;
+        VkImage gBufferNormalsImage;
+        VkDeviceMemory gBufferNormalsMemory;
+        VkImageView gBufferNormalsView;
+
+        // Farthest-depth pyramid of the previous frame
+        VkImage hiZImage;
+        VkDeviceMemory hiZImageMemory;
+        VkImageView hiZImageView;
+        std::vector<VkImageView> hiZMipViews;
+        VkSampler hiZSampler;
+        VkExtent2D hiZExtent;
+        uint32_t hiZLevels = 0;
+        bool hiZValid = false;
+        glm::mat4 hiZViewProj = glm::mat4(1.0f);
+
+        std::vector<Vertex> meshVertices;
+        LodChain meshLods;
+        LodSelector lodSelector;
+        // Level each object was last drawn with, for the selector's
+        // hysteresis; with GPU culling it is kept in objectLodBuffer
+        std::vector<uint8_t> objectLods;
+        glm::mat4 viewProjMatrix = glm::mat4(1.0f);
+        // Only advances while animating, so a paused scene resumes where it
+        // stopped
+        float sceneTime = 0.0f;
+        bool animating = true;
+        std::chrono::high_resolution_clock::time_point lastSceneUpdate;
+
+        SceneGraph sceneGraph;
+        std::vector<NodeHandle> objectNodes;
+        std::vector<ShaderProgram> objectPrograms;
+        std::array<uint32_t, END_OF_SHADERS> programObjectCounts;
+        std::vector<uint32_t> nodeObjects;
+        std::vector<uint32_t> movedObjects;
+        std::vector<uint32_t> pendingUploads;
+        std::vector<uint8_t> uploadPending;
+        BoundsSoA objectBounds;
+        std::vector<Aabb> objectAabbs;
+        Bvh sceneBvh;
+        std::vector<uint32_t> visibleObjects;
+        CullScratch cullScratch;
+        std::vector<DrawItem> drawItems;
+        std::vector<DrawItem> drawScratch;
+
+        FrameStats frameStats;
+        std::chrono::high_resolution_clock::time_point lastFrameStart;
+        StatsReporter statsReporter;
+        FrameLimiter frameLimiter;
+
+        // Per frame in flight, a begin and end timestamp and a fragment
+        // invocation count for every shader program
+        bool programQueriesEnabled = false;
+        bool fragmentStatisticsSupported = false;
+        float timestampPeriod = 1.0f;
+        VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+        VkQueryPool statisticsQueryPool = VK_NULL_HANDLE;
+        std::vector<uint32_t> programQueriesWritten;
 
         VkBuffer vertexBuffer;
         VkDeviceMemory vertexBufferMemory;
         VkBuffer indexBuffer;
         VkDeviceMemory indexBufferMemory;
+        // Indexed by currentFrame and reused once that frame's fence has
+        // signalled, so they don't depend on the swapchain
+        // Mapped for as long as they exist; only the parts that changed
+        // since a frame last used its copy are written
         std::vector<VkBuffer> uniformTransforms;
         std::vector<VkDeviceMemory> uniformTransformsMemory;
+        std::vector<void *> uniformTransformsMapped;
+        TrackedUniform<UniformTransformObject> transformUniform;
+        VkExtent2D cameraExtent = {0, 0};
         std::vector<VkBuffer> uniformLights;
         std::vector<VkDeviceMemory> uniformLightsMemory;
-
-        VkDescriptorPool descriptorPool;
+        std::vector<void *> uniformLightsMapped;
+        TrackedUniform<UniformLightObject> lightUniform;
+        std::vector<VkBuffer> uniformCulls;
+        std::vector<VkDeviceMemory> uniformCullsMemory;
+        std::vector<void *> uniformCullsMapped;
+        TrackedUniform<UniformCullObject> cullUniform;
+
+        // Point and spot lights in world space, and in view space for the
+        // clusters
+        std::vector<PointLight> sceneLights;
+        std::vector<PointLight> viewLights;
+        LightClusters lightClusters;
+        bool clustersStale = true;
+        float clustersTime = 0.0f;
+        // Per frame in flight, the lights, then the clusters, then the
+        // light index list, each at a storage buffer offset. A frame's copy
+        // is only rewritten when it is older than lightClusterVersion.
+        std::vector<VkBuffer> lightClusterBuffers;
+        std::vector<VkDeviceMemory> lightClusterBuffersMemory;
+        std::vector<void *> lightClusterBuffersMapped;
+        std::vector<uint64_t> lightClusterFrameVersions;
+        uint64_t lightClusterVersion = 0;
+        VkDeviceSize clusterOffset = 0;
+        VkDeviceSize lightIndexOffset = 0;
+        VkDeviceSize storageBufferAlignment = 1;
+        // Per frame in flight, a model matrix per draw every drawUniformStride
+        // bytes for OBJECT_DATA_DYNAMIC
+        std::vector<VkBuffer> drawUniforms;
+        std::vector<VkDeviceMemory> drawUniformsMemory;
+        VkDeviceSize drawUniformStride = sizeof(glm::mat4);
+
+        VkBuffer objectBuffer;
+        VkDeviceMemory objectBufferMemory;
+        std::vector<VkBuffer> objectStagingBuffers;
+        std::vector<VkDeviceMemory> objectStagingBuffersMemory;
+        std::vector<VkBufferCopy> objectCopies;
+        VkBuffer drawCommandBuffer;
+        VkDeviceMemory drawCommandBufferMemory;
+        VkBuffer drawCountBuffer;
+        VkDeviceMemory drawCountBufferMemory;
+        VkBuffer objectLodBuffer;
+        VkDeviceMemory objectLodBufferMemory;
+        bool objectLodsCleared = false;
+
+        // Sets of the per-frame resources, which live as long as the device
+        DescriptorAllocator descriptorAllocator;
+        // Sets that point at size-dependent images. They're returned
+        // together when the swapchain is recreated and the pools are reused
+        // for the new ones.
+        DescriptorAllocator swapchainDescriptorAllocator;
         std::vector<std::vector<VkDescriptorSet>> descriptorSets;
+        std::vector<VkDescriptorSet> cullDescriptorSets;
+        std::vector<VkDescriptorSet> hiZDescriptorSets;
+        VkDescriptorSet lightingDescriptorSet;
 
         VkCommandPool commandPool;
         std::vector<VkCommandBuffer> commandBuffers;
@@ -169,9 +485,13 @@ class ShadedCubeApp {
         std::vector<VkSemaphore> imageAvailableSemaphores;
         std::vector<VkSemaphore> renderCompleteSemaphores;
         std::vector<VkFence> inFlightFences;
-        std::vector<VkFence> imagesInFlight;
         size_t currentFrame = 0;
         bool framebufferResized = false;
+        // Frames still to draw for --on-demand, whatever else changes
+        uint32_t redrawFrames = 0;
+        VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        // The oldest input no frame has reacted to yet
+        std::optional<std::chrono::high_resolution_clock::time_point> pendingInput;
         const float rotationSpeed = 2.5f;
 
         // Helpers
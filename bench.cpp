@@ -0,0 +1,328 @@
+#include "bvh.h"
+#include "culling.h"
+#include "draw_sort.h"
+#include "frame_limiter.h"
+#include "light_clusters.h"
+#include "mesh.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/gtc/matrix_transform.hpp>
+
+// Runs fn a number of times and returns the median time in milliseconds
+double timeMedian(int runs, const std::function<void()>& fn) {
+    std::vector<double> times;
+    for(int i = 0; i < runs; i++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        auto end = std::chrono::high_resolution_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+glm::mat4 benchViewProj() {
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 500.0f);
+    proj[1][1] *= -1;
+    return proj * view;
+}
+
+void benchFrustumCulling(size_t objectCount) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.5f, 2.0f);
+
+    BoundsSoA bounds;
+    bounds.resize(objectCount);
+    for(size_t i = 0; i < objectCount; i++)
+        bounds.set(i, glm::vec3(position(rng), position(rng), position(rng)), size(rng));
+
+    Frustum frustum = extractFrustum(benchViewProj());
+    std::vector<uint32_t> visible;
+    CullScratch scratch;
+
+    struct {
+        const char *name;
+        CullKernel kernel;
+    } kernels[] = {
+        {"scalar", CULL_KERNEL_SCALAR},
+        {"sse", CULL_KERNEL_SSE},
+        {"avx2", CULL_KERNEL_AVX2}
+    };
+
+    printf("frustum culling, %zu objects\n", objectCount);
+    for(const auto& k: kernels) {
+        if (!cullKernelSupported(k.kernel))
+            continue;
+
+        double single = timeMedian(21, [&]() { cullBounds(bounds, frustum, visible, scratch, nullptr, k.kernel); });
+        double parallel = timeMedian(21, [&]() { cullBounds(bounds, frustum, visible, scratch, &workerPool(), k.kernel); });
+        printf("  %-6s 1 thread: %8.3f ms  %zu threads: %8.3f ms  visible: %zu\n", k.name, single, workerPool().size() + 1, parallel, visible.size());
+    }
+}
+
+void benchBvh(size_t objectCount) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.5f, 2.0f);
+    std::uniform_real_distribution<float> jitter(-0.25f, 0.25f);
+
+    std::vector<Aabb> bounds(objectCount);
+    for(auto& box: bounds)
+        box = Aabb::fromSphere(glm::vec3(position(rng), position(rng), position(rng)), size(rng));
+
+    Bvh bvh;
+    double serialBuild = timeMedian(3, [&]() { bvh.build(bounds); });
+    double parallelBuild = timeMedian(3, [&]() { bvh.build(bounds, &workerPool()); });
+
+    // One in a hundred objects moves every frame
+    std::vector<uint32_t> moved;
+    for(size_t i = 0; i < objectCount; i += 100)
+        moved.push_back(static_cast<uint32_t>(i));
+    auto animate = [&]() {
+        for(uint32_t i: moved) {
+            glm::vec3 offset(jitter(rng), jitter(rng), jitter(rng));
+            bounds[i].min += offset;
+            bounds[i].max += offset;
+        }
+    };
+
+    animate();
+    double fullRefit = timeMedian(11, [&]() { bvh.refit(bounds); });
+    animate();
+    double partialRefit = timeMedian(11, [&]() { bvh.refit(bounds, moved); });
+
+    Frustum frustum = extractFrustum(benchViewProj());
+    std::vector<uint32_t> visible;
+    double cull = timeMedian(11, [&]() { bvh.cullFrustum(frustum, visible); });
+
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    std::vector<glm::vec3> rays(1000);
+    for(auto& ray: rays)
+        ray = glm::normalize(glm::vec3(direction(rng), direction(rng), direction(rng)));
+    size_t hits = 0;
+    double pick = timeMedian(11, [&]() {
+        hits = 0;
+        for(const auto& ray: rays) {
+            uint32_t object;
+            float distance;
+            hits += bvh.raycast(glm::vec3(0.0f), ray, 1000.0f, &object, &distance);
+        }
+    });
+
+    printf("bvh, %zu objects, %zu nodes\n", objectCount, bvh.nodeCount());
+    printf("  build      serial: %8.3f ms  parallel: %8.3f ms\n", serialBuild, parallelBuild);
+    printf("  refit      full:   %8.3f ms  1%% moved: %8.3f ms\n", fullRefit, partialRefit);
+    printf("  frustum    %8.3f ms  visible: %zu\n", cull, visible.size());
+    printf("  1000 rays  %8.3f ms  hits: %zu\n", pick, hits);
+}
+
+void benchSceneGraph(size_t rootCount, size_t childCount) {
+    SceneGraph scene;
+    std::vector<NodeHandle> roots;
+    for(size_t i = 0; i < rootCount; i++) {
+        NodeHandle root = scene.addNode(INVALID_NODE, glm::translate(glm::mat4(1.0f), glm::vec3(float(i), 0.0f, 0.0f)));
+        roots.push_back(root);
+        for(size_t j = 0; j < childCount; j++)
+            scene.addNode(root, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, float(j), 0.0f)));
+    }
+    scene.update();
+
+    float angle = 0.0f;
+    auto move = [&](size_t step) {
+        angle += 0.01f;
+        glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 0.0f, 1.0f));
+        for(size_t i = 0; i < roots.size(); i += step)
+            scene.setLocalTransform(roots[i], rotation);
+        return scene.update();
+    };
+
+    size_t allUpdated = 0, fewUpdated = 0;
+    double all = timeMedian(11, [&]() { allUpdated = move(1); });
+    double few = timeMedian(11, [&]() { fewUpdated = move(100); });
+
+    printf("scene graph, %zu nodes\n", scene.size());
+    printf("  all dirty: %8.3f ms (%zu nodes)  1%% dirty: %8.3f ms (%zu nodes)\n", all, allUpdated, few, fewUpdated);
+}
+
+void benchDrawSort(size_t drawCount) {
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<uint32_t> pipeline(0, 3);
+    std::uniform_int_distribution<uint32_t> mesh(0, 15);
+    std::uniform_int_distribution<uint32_t> lod(0, DRAW_KEY_MAX_LODS - 1);
+    std::uniform_real_distribution<float> depth(0.1f, 500.0f);
+
+    std::vector<DrawItem> draws(drawCount);
+    for(size_t i = 0; i < drawCount; i++)
+        draws[i] = {makeDrawKey(pipeline(rng), 0, mesh(rng), lod(rng), depth(rng)), static_cast<uint32_t>(i)};
+
+    std::vector<DrawItem> items, scratch;
+    auto byKey = [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; };
+    double stdSort = timeMedian(11, [&]() { items = draws; std::stable_sort(items.begin(), items.end(), byKey); });
+    std::vector<DrawItem> expected = items;
+    double single = timeMedian(11, [&]() { items = draws; sortDraws(items, scratch); });
+    double parallel = timeMedian(11, [&]() { items = draws; sortDraws(items, scratch, &workerPool()); });
+
+    bool sorted = true;
+    for(size_t i = 0; i < drawCount; i++)
+        sorted = sorted && items[i].key == expected[i].key && items[i].object == expected[i].object;
+
+    // Copying the unsorted draws is part of every measurement
+    double copy = timeMedian(11, [&]() { items = draws; });
+
+    printf("draw sort, %zu draws%s\n", drawCount, sorted ? "" : " (MISMATCH)");
+    printf("  std::stable_sort: %8.3f ms  radix 1 thread: %8.3f ms  %zu threads: %8.3f ms\n", stdSort - copy, single - copy, workerPool().size() + 1, parallel - copy);
+}
+
+void benchLightClusters(size_t lightCount) {
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<float> horizontal(-8.0f, 8.0f);
+    std::uniform_real_distribution<float> depth(-10.0f, -0.1f);
+    std::uniform_real_distribution<float> range(0.5f, 1.5f);
+
+    std::vector<PointLight> lights;
+    for(size_t i = 0; i < lightCount; i++)
+        lights.push_back(PointLight::point(glm::vec3(horizontal(rng), horizontal(rng), depth(rng)), range(rng), glm::vec3(1.0f)));
+
+    LightClusters clusters;
+    double setup = timeMedian(5, [&]() { clusters.setProjection(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 10.0f); });
+    double single = timeMedian(11, [&]() { clusters.build(lights); });
+    double parallel = timeMedian(11, [&]() { clusters.build(lights, &workerPool()); });
+
+    uint32_t maxCount = 0;
+    for(const auto& cluster: clusters.getClusters())
+        maxCount = std::max(maxCount, cluster.count);
+
+    printf("light clusters, %zu lights, %u clusters\n", lightCount, CLUSTER_COUNT);
+    printf("  bounds: %8.3f ms  1 thread: %8.3f ms  %zu threads: %8.3f ms  lights per cluster: %.2f avg, %u max\n",
+        setup, single, workerPool().size() + 1, parallel, double(clusters.getLightIndices().size()) / CLUSTER_COUNT, maxCount);
+}
+
+// Builds the LOD chain of a sphere and checks that every level is reduced
+// to the target of about half the previous one's triangles, within its
+// error budget. Returns whether it is.
+bool benchLodChain(uint32_t subdivisions) {
+    std::vector<Vertex> vertices;
+    std::vector<uint16_t> indices;
+    buildSphere(subdivisions, vertices, indices);
+
+    LodChain chain;
+    double build = timeMedian(5, [&]() { chain = buildLodChain(vertices, indices); });
+
+    bool valid = chain.lods.size() == MAX_LOD_LEVELS;
+    printf("lod chain, sphere with %zu triangles, radius %.3f\n", indices.size() / 3, chain.radius);
+    printf("  build: %8.3f ms\n", build);
+    for(uint32_t level = 0; level < chain.lods.size(); level++) {
+        const MeshLod& lod = chain.lods[level];
+        float budget = lodErrorBudget(chain.radius, level);
+        bool reduced = level == 0 || lod.indexCount <= chain.lods[level - 1].indexCount / 6 * 3;
+        bool bounded = lod.error <= budget;
+        valid = valid && reduced && bounded;
+        printf("  LOD #%u: %6u triangles  error %.5f  budget %.5f%s\n", level, lod.indexCount / 3, lod.error, budget, reduced && bounded ? "" : " (CHECK FAILED)");
+    }
+    if (chain.lods.size() != MAX_LOD_LEVELS)
+        printf("  %zu of %u levels built (CHECK FAILED)\n", chain.lods.size(), MAX_LOD_LEVELS);
+    return valid;
+}
+
+double processCpuSeconds() {
+    timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Paces frames of 3 ms of busy work at the target rate and reports how
+// evenly their ends are spaced and how much of a core the pacing takes
+void benchFrameLimiter(double targetFps, int frameCount) {
+    typedef std::chrono::steady_clock Clock;
+    auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+
+    auto work = []() {
+        auto end = Clock::now() + std::chrono::microseconds(3000);
+        while (Clock::now() < end);
+    };
+
+    struct {
+        const char *name;
+        std::function<void(Clock::time_point)> wait;
+    } strategies[] = {
+        {"sleep", [](Clock::time_point start) { std::this_thread::sleep_until(start); }},
+        {"spin", [](Clock::time_point start) { while (Clock::now() < start); }},
+        {"hybrid", nullptr}
+    };
+
+    printf("frame limiter, %.0f fps, %d frames\n", targetFps, frameCount);
+    for(const auto& strategy: strategies) {
+        FrameLimiter limiter(strategy.wait ? 0.0 : targetFps);
+        std::vector<double> intervals;
+        double cpuStart = processCpuSeconds();
+        auto wallStart = Clock::now();
+        auto start = wallStart;
+        auto lastEnd = wallStart;
+
+        for(int i = 0; i < frameCount; i++) {
+            if (strategy.wait) {
+                start += period;
+                strategy.wait(start);
+            } else
+                limiter.beginFrame();
+            work();
+            if (!strategy.wait)
+                limiter.endFrame();
+
+            // The first frame only seeds the limiter's cost prediction
+            auto end = Clock::now();
+            if (i > 1)
+                intervals.push_back(std::chrono::duration<double, std::milli>(end - lastEnd).count());
+            lastEnd = end;
+        }
+
+        double cpu = (processCpuSeconds() - cpuStart) / std::chrono::duration<double>(lastEnd - wallStart).count() * 100.0;
+        double mean = 0.0;
+        for(double interval: intervals)
+            mean += interval;
+        mean /= intervals.size();
+        double variance = 0.0, worst = 0.0;
+        for(double interval: intervals) {
+            variance += (interval - mean) * (interval - mean);
+            worst = std::max(worst, std::abs(interval - mean));
+        }
+
+        printf("  %-6s frame %8.3f ms  jitter %6.3f ms  worst %6.3f ms  cpu %5.1f%%\n", strategy.name, mean, std::sqrt(variance / intervals.size()), worst, cpu);
+    }
+}
+
+int main() {
+    benchFrustumCulling(1000000);
+
+    for(size_t objectCount: {10000, 100000, 1000000})
+        benchBvh(objectCount);
+
+    benchSceneGraph(1000, 99);
+
+    for(size_t drawCount: {10000, 100000, 1000000})
+        benchDrawSort(drawCount);
+
+    for(size_t lightCount: {100, 1000})
+        benchLightClusters(lightCount);
+
+    bool lodValid = benchLodChain(4);
+
+    benchFrameLimiter(60.0, 120);
+
+    return lodValid ? 0 : 1;
+}
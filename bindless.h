@@ -0,0 +1,40 @@
+#ifndef VULKAN_BINDLESS_H
+#define VULKAN_BINDLESS_H
+
+#include "vulkan/include/vulkan/vulkan.h"
+
+#include <cstdint>
+#include <vector>
+
+// One descriptor set holding a large, partially bound array of storage
+// buffers. Shaders pick buffers by their index in the array, so adding a
+// buffer means writing one descriptor instead of a new set layout and
+// another bind. Slots are written with UPDATE_AFTER_BIND, so buffers can be
+// added while command buffers using the set are pending.
+class BindlessDescriptors {
+    public:
+        void create(VkDevice device, uint32_t capacity);
+        void destroy();
+
+        VkDescriptorSetLayout getLayout() const { return layout; }
+        VkDescriptorSet getSet() const { return set; }
+        uint32_t getCapacity() const { return capacity; }
+        uint32_t size() const { return nextIndex - static_cast<uint32_t>(freeIndices.size()); }
+
+        // Returns the buffer's index in the shaders' array
+        uint32_t addStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+        // The slot is reused by later buffers, so no command buffer that
+        // reads it may still be pending
+        void remove(uint32_t index);
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        uint32_t capacity = 0;
+        uint32_t nextIndex = 0;
+        std::vector<uint32_t> freeIndices;
+};
+
+#endif
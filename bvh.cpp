@@ -0,0 +1,488 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+
+// Below this many objects a node is binned on the calling thread
+const uint32_t BVH_PARALLEL_BINNING_THRESHOLD = 65536;
+// Smallest subtree handed to a worker as a whole
+const uint32_t BVH_MIN_PARALLEL_SUBTREE = 4096;
+// SAH may keep a node as a leaf up to this size when splitting doesn't pay off
+const uint32_t BVH_MAX_SAH_LEAF_SIZE = 16;
+
+struct Bin {
+    Aabb bounds;
+    uint32_t count = 0;
+};
+
+struct BinningResult {
+    Aabb nodeBounds;
+    Aabb centroidBounds;
+};
+
+enum PlaneSide {
+    OUTSIDE,
+    INTERSECTING,
+    INSIDE
+};
+
+PlaneSide classify(const Frustum& frustum, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    PlaneSide side = INSIDE;
+    for(const auto& plane: frustum.planes) {
+        // Corner furthest along the plane normal, and the one opposite it
+        glm::vec3 positive(
+            plane.x >= 0.0f ? boundsMax.x : boundsMin.x,
+            plane.y >= 0.0f ? boundsMax.y : boundsMin.y,
+            plane.z >= 0.0f ? boundsMax.z : boundsMin.z
+        );
+        glm::vec3 negative(
+            plane.x >= 0.0f ? boundsMin.x : boundsMax.x,
+            plane.y >= 0.0f ? boundsMin.y : boundsMax.y,
+            plane.z >= 0.0f ? boundsMin.z : boundsMax.z
+        );
+        if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+            return OUTSIDE;
+        if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f)
+            side = INTERSECTING;
+    }
+    return side;
+}
+
+float intersectSlabs(const glm::vec3& origin, const glm::vec3& invDirection, float maxDistance, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    glm::vec3 t0 = (boundsMin - origin) * invDirection;
+    glm::vec3 t1 = (boundsMax - origin) * invDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+
+    float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+
+    return entry <= exit ? entry : FLT_MAX;
+}
+
+}
+
+void Bvh::build(const std::vector<Aabb>& objectBounds, ThreadPool *pool) {
+    uint32_t count = static_cast<uint32_t>(objectBounds.size());
+
+    items.resize(count);
+    for(uint32_t i = 0; i < count; i++)
+        items[i] = {objectBounds[i], objectBounds[i].center(), i};
+
+    nodes.clear();
+    parents.clear();
+    objectIndices.resize(count);
+    bounds.resize(count);
+    objectSlots.resize(count);
+    objectLeaves.assign(count, 0);
+    if (count == 0)
+        return;
+
+    nodes.resize(2 * count - 1);
+    nodesUsed = 1;
+
+    Subtree root = {0, 0, count};
+    if (pool == nullptr || count <= BVH_MIN_PARALLEL_SUBTREE) {
+        buildSubtree(root);
+    } else {
+        // Split the top of the tree here until there are enough
+        // independent subtrees to keep every worker busy
+        uint32_t subtreeSize = std::max<uint32_t>(BVH_MIN_PARALLEL_SUBTREE, count / static_cast<uint32_t>(pool->size() * 8 + 1));
+        std::vector<Subtree> pending = {root};
+        std::vector<Subtree> subtrees;
+
+        while (!pending.empty()) {
+            Subtree subtree = pending.back();
+            pending.pop_back();
+
+            if (subtree.count <= subtreeSize) {
+                subtrees.push_back(subtree);
+                continue;
+            }
+
+            Subtree left, right;
+            if (splitNode(subtree, left, right, pool)) {
+                pending.push_back(left);
+                pending.push_back(right);
+            }
+        }
+
+        pool->parallelFor(subtrees.size(), 1, [&](size_t begin, size_t end, size_t) {
+            for(size_t i = begin; i < end; i++)
+                buildSubtree(subtrees[i]);
+        });
+    }
+
+    for(uint32_t slot = 0; slot < count; slot++) {
+        objectIndices[slot] = items[slot].object;
+        objectSlots[items[slot].object] = slot;
+        bounds[slot] = items[slot].bounds;
+    }
+    items.clear();
+    items.shrink_to_fit();
+
+    nodes.resize(nodesUsed);
+    flatten();
+}
+
+void Bvh::buildSubtree(const Subtree& root) {
+    std::vector<Subtree> stack = {root};
+    while (!stack.empty()) {
+        Subtree subtree = stack.back();
+        stack.pop_back();
+
+        Subtree left, right;
+        if (splitNode(subtree, left, right, nullptr)) {
+            stack.push_back(right);
+            stack.push_back(left);
+        }
+    }
+}
+
+bool Bvh::splitNode(const Subtree& subtree, Subtree& left, Subtree& right, ThreadPool *pool) {
+    BuildItem *first = items.data() + subtree.first;
+    BvhNode& node = nodes[subtree.node];
+
+    // Bounds of the objects and of their centroids, then a histogram of
+    // the centroids along each axis. Both run in chunks for large nodes.
+    auto gatherBounds = [&](uint32_t begin, uint32_t end, BinningResult& result) {
+        for(uint32_t i = begin; i < end; i++) {
+            result.nodeBounds.grow(first[i].bounds);
+            result.centroidBounds.grow(first[i].centroid);
+        }
+    };
+
+    BinningResult extent;
+    bool parallel = pool != nullptr && subtree.count > BVH_PARALLEL_BINNING_THRESHOLD;
+    size_t chunkSize = parallel ? BVH_PARALLEL_BINNING_THRESHOLD / 4 : subtree.count;
+    size_t chunkCount = (subtree.count + chunkSize - 1) / chunkSize;
+
+    if (parallel) {
+        std::vector<BinningResult> partial(chunkCount);
+        pool->parallelFor(subtree.count, chunkSize, [&](size_t begin, size_t end, size_t chunk) {
+            gatherBounds(static_cast<uint32_t>(begin), static_cast<uint32_t>(end), partial[chunk]);
+        });
+        for(const auto& result: partial) {
+            extent.nodeBounds.grow(result.nodeBounds);
+            extent.centroidBounds.grow(result.centroidBounds);
+        }
+    } else
+        gatherBounds(0, subtree.count, extent);
+
+    node.boundsMin = extent.nodeBounds.min;
+    node.boundsMax = extent.nodeBounds.max;
+    node.leftOrFirst = subtree.first;
+    node.objectCount = subtree.count;
+
+    if (subtree.count <= BVH_MAX_LEAF_SIZE)
+        return false;
+
+    glm::vec3 centroidMin = extent.centroidBounds.min;
+    glm::vec3 centroidExtent = extent.centroidBounds.max - centroidMin;
+
+    glm::vec3 binScale;
+    for(int axis = 0; axis < 3; axis++)
+        binScale[axis] = centroidExtent[axis] > 0.0f ? BVH_BIN_COUNT / centroidExtent[axis] : 0.0f;
+
+    auto binOf = [&](const glm::vec3& centroid, int axis) {
+        int bin = static_cast<int>((centroid[axis] - centroidMin[axis]) * binScale[axis]);
+        return std::min(std::max(bin, 0), static_cast<int>(BVH_BIN_COUNT) - 1);
+    };
+
+    typedef std::array<std::array<Bin, BVH_BIN_COUNT>, 3> AxisBins;
+    auto fillBins = [&](uint32_t begin, uint32_t end, AxisBins& bins) {
+        for(uint32_t i = begin; i < end; i++) {
+            for(int axis = 0; axis < 3; axis++) {
+                if (centroidExtent[axis] <= 0.0f)
+                    continue;
+                Bin& bin = bins[axis][binOf(first[i].centroid, axis)];
+                bin.bounds.grow(first[i].bounds);
+                bin.count++;
+            }
+        }
+    };
+
+    AxisBins bins;
+    if (parallel) {
+        std::vector<AxisBins> partial(chunkCount);
+        pool->parallelFor(subtree.count, chunkSize, [&](size_t begin, size_t end, size_t chunk) {
+            fillBins(static_cast<uint32_t>(begin), static_cast<uint32_t>(end), partial[chunk]);
+        });
+        for(const auto& chunkBins: partial) {
+            for(int axis = 0; axis < 3; axis++) {
+                for(uint32_t b = 0; b < BVH_BIN_COUNT; b++) {
+                    bins[axis][b].bounds.grow(chunkBins[axis][b].bounds);
+                    bins[axis][b].count += chunkBins[axis][b].count;
+                }
+            }
+        }
+    } else
+        fillBins(0, subtree.count, bins);
+
+    // Sweep the bins from both ends to evaluate every split plane
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+    for(int axis = 0; axis < 3; axis++) {
+        if (centroidExtent[axis] <= 0.0f)
+            continue;
+
+        float leftArea[BVH_BIN_COUNT - 1], rightArea[BVH_BIN_COUNT - 1];
+        uint32_t leftCount[BVH_BIN_COUNT - 1], rightCount[BVH_BIN_COUNT - 1];
+        Aabb leftBox, rightBox;
+        uint32_t leftSum = 0, rightSum = 0;
+        for(uint32_t i = 0; i < BVH_BIN_COUNT - 1; i++) {
+            leftSum += bins[axis][i].count;
+            leftCount[i] = leftSum;
+            leftBox.grow(bins[axis][i].bounds);
+            leftArea[i] = leftBox.surfaceArea();
+
+            rightSum += bins[axis][BVH_BIN_COUNT - 1 - i].count;
+            rightCount[BVH_BIN_COUNT - 2 - i] = rightSum;
+            rightBox.grow(bins[axis][BVH_BIN_COUNT - 1 - i].bounds);
+            rightArea[BVH_BIN_COUNT - 2 - i] = rightBox.surfaceArea();
+        }
+
+        for(uint32_t i = 0; i < BVH_BIN_COUNT - 1; i++) {
+            if (leftCount[i] == 0 || rightCount[i] == 0)
+                continue;
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    // Every centroid coincides, nothing sensible to split on
+    if (bestAxis < 0)
+        return false;
+
+    float leafCost = subtree.count * extent.nodeBounds.surfaceArea();
+    if (bestCost >= leafCost && subtree.count <= BVH_MAX_SAH_LEAF_SIZE)
+        return false;
+
+    BuildItem *middle = std::partition(first, first + subtree.count, [&](const BuildItem& item) {
+        return binOf(item.centroid, bestAxis) <= static_cast<int>(bestSplit);
+    });
+    uint32_t leftObjects = static_cast<uint32_t>(middle - first);
+
+    uint32_t children = nodesUsed.fetch_add(2);
+    node.leftOrFirst = children;
+    node.objectCount = 0;
+
+    left = {children, subtree.first, leftObjects};
+    right = {children + 1, subtree.first + leftObjects, subtree.count - leftObjects};
+    return true;
+}
+
+void Bvh::flatten() {
+    // Re-lays the nodes out depth first, so that a subtree is mostly
+    // contiguous in memory no matter which worker built it. Children
+    // always end up after their parent, which is what refit relies on.
+    std::vector<BvhNode> flattened;
+    flattened.reserve(nodes.size());
+    flattened.push_back(nodes[0]);
+    parents.assign(1, 0);
+
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 0}};
+    while (!stack.empty()) {
+        uint32_t oldIndex = stack.back().first;
+        uint32_t newIndex = stack.back().second;
+        stack.pop_back();
+
+        if (nodes[oldIndex].isLeaf())
+            continue;
+
+        uint32_t oldLeft = nodes[oldIndex].leftOrFirst;
+        uint32_t newLeft = static_cast<uint32_t>(flattened.size());
+        flattened.push_back(nodes[oldLeft]);
+        flattened.push_back(nodes[oldLeft + 1]);
+        parents.push_back(newIndex);
+        parents.push_back(newIndex);
+        flattened[newIndex].leftOrFirst = newLeft;
+
+        stack.push_back({oldLeft + 1, newLeft + 1});
+        stack.push_back({oldLeft, newLeft});
+    }
+
+    nodes = std::move(flattened);
+
+    for(uint32_t i = 0; i < nodes.size(); i++) {
+        if (!nodes[i].isLeaf())
+            continue;
+        for(uint32_t k = 0; k < nodes[i].objectCount; k++)
+            objectLeaves[objectIndices[nodes[i].leftOrFirst + k]] = i;
+    }
+    refitMarks.assign(nodes.size(), 0);
+}
+
+void Bvh::refit(const std::vector<Aabb>& objectBounds) {
+    for(size_t slot = 0; slot < objectIndices.size(); slot++)
+        bounds[slot] = objectBounds[objectIndices[slot]];
+
+    for(size_t i = nodes.size(); i-- > 0;) {
+        BvhNode& node = nodes[i];
+        Aabb box;
+        if (node.isLeaf()) {
+            for(uint32_t k = 0; k < node.objectCount; k++)
+                box.grow(bounds[node.leftOrFirst + k]);
+        } else {
+            const BvhNode& leftChild = nodes[node.leftOrFirst];
+            const BvhNode& rightChild = nodes[node.leftOrFirst + 1];
+            box.min = glm::min(leftChild.boundsMin, rightChild.boundsMin);
+            box.max = glm::max(leftChild.boundsMax, rightChild.boundsMax);
+        }
+        node.boundsMin = box.min;
+        node.boundsMax = box.max;
+    }
+}
+
+void Bvh::refit(const std::vector<Aabb>& objectBounds, const std::vector<uint32_t>& changedObjects) {
+    if (nodes.empty())
+        return;
+
+    // Collect every node on a path from a moved object to the root
+    refitNodes.clear();
+    for(uint32_t object: changedObjects) {
+        bounds[objectSlots[object]] = objectBounds[object];
+
+        uint32_t node = objectLeaves[object];
+        while (!refitMarks[node]) {
+            refitMarks[node] = 1;
+            refitNodes.push_back(node);
+            if (node == 0)
+                break;
+            node = parents[node];
+        }
+    }
+
+    // Children always have higher indices than their parents, so walking
+    // the touched nodes in descending order updates children first. When
+    // most of the tree moved, a scan over the marks beats sorting.
+    if (refitNodes.size() * 4 > nodes.size()) {
+        refitNodes.clear();
+        for(size_t i = nodes.size(); i-- > 0;) {
+            if (refitMarks[i])
+                refitNodes.push_back(static_cast<uint32_t>(i));
+        }
+    } else
+        std::sort(refitNodes.begin(), refitNodes.end(), std::greater<uint32_t>());
+
+    for(uint32_t i: refitNodes) {
+        BvhNode& node = nodes[i];
+        Aabb box;
+        if (node.isLeaf()) {
+            for(uint32_t k = 0; k < node.objectCount; k++)
+                box.grow(bounds[node.leftOrFirst + k]);
+        } else {
+            const BvhNode& leftChild = nodes[node.leftOrFirst];
+            const BvhNode& rightChild = nodes[node.leftOrFirst + 1];
+            box.min = glm::min(leftChild.boundsMin, rightChild.boundsMin);
+            box.max = glm::max(leftChild.boundsMax, rightChild.boundsMax);
+        }
+        node.boundsMin = box.min;
+        node.boundsMax = box.max;
+        refitMarks[i] = 0;
+    }
+}
+
+void Bvh::appendSubtree(uint32_t nodeIndex, std::vector<uint32_t>& out) const {
+    // The objects below a node are one contiguous range of objectIndices
+    uint32_t first = nodeIndex;
+    while (!nodes[first].isLeaf())
+        first = nodes[first].leftOrFirst;
+    uint32_t last = nodeIndex;
+    while (!nodes[last].isLeaf())
+        last = nodes[last].leftOrFirst + 1;
+
+    out.insert(
+        out.end(),
+        objectIndices.begin() + nodes[first].leftOrFirst,
+        objectIndices.begin() + nodes[last].leftOrFirst + nodes[last].objectCount
+    );
+}
+
+void Bvh::cullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const {
+    visible.clear();
+    if (nodes.empty())
+        return;
+
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty()) {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        const BvhNode& node = nodes[index];
+
+        PlaneSide side = classify(frustum, node.boundsMin, node.boundsMax);
+        if (side == OUTSIDE)
+            continue;
+        if (side == INSIDE) {
+            appendSubtree(index, visible);
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            for(uint32_t k = 0; k < node.objectCount; k++) {
+                const Aabb& box = bounds[node.leftOrFirst + k];
+                if (classify(frustum, box.min, box.max) != OUTSIDE)
+                    visible.push_back(objectIndices[node.leftOrFirst + k]);
+            }
+        } else {
+            stack.push_back(node.leftOrFirst + 1);
+            stack.push_back(node.leftOrFirst);
+        }
+    }
+}
+
+bool Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, uint32_t *hitObject, float *hitDistance) const {
+    if (nodes.empty())
+        return false;
+
+    glm::vec3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    float closest = maxDistance;
+    bool hit = false;
+
+    std::vector<uint32_t> stack;
+    if (intersectSlabs(origin, invDirection, closest, nodes[0].boundsMin, nodes[0].boundsMax) != FLT_MAX)
+        stack.push_back(0);
+
+    while (!stack.empty()) {
+        const BvhNode& node = nodes[stack.back()];
+        stack.pop_back();
+
+        if (node.isLeaf()) {
+            for(uint32_t k = 0; k < node.objectCount; k++) {
+                const Aabb& box = bounds[node.leftOrFirst + k];
+                float t = intersectSlabs(origin, invDirection, closest, box.min, box.max);
+                if (t < closest) {
+                    closest = t;
+                    hit = true;
+                    if (hitObject != nullptr)
+                        *hitObject = objectIndices[node.leftOrFirst + k];
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first so that it can prune the other one
+        uint32_t nearChild = node.leftOrFirst, farChild = node.leftOrFirst + 1;
+        float nearT = intersectSlabs(origin, invDirection, closest, nodes[nearChild].boundsMin, nodes[nearChild].boundsMax);
+        float farT = intersectSlabs(origin, invDirection, closest, nodes[farChild].boundsMin, nodes[farChild].boundsMax);
+        if (farT < nearT) {
+            std::swap(nearChild, farChild);
+            std::swap(nearT, farT);
+        }
+        if (farT != FLT_MAX)
+            stack.push_back(farChild);
+        if (nearT != FLT_MAX)
+            stack.push_back(nearChild);
+    }
+
+    if (hit && hitDistance != nullptr)
+        *hitDistance = closest;
+    return hit;
+}
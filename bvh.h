@@ -0,0 +1,108 @@
+#ifndef VULKAN_BVH_H
+#define VULKAN_BVH_H
+
+#include "culling.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct Aabb {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    static Aabb fromSphere(const glm::vec3& center, float radius) {
+        return {center - glm::vec3(radius), center + glm::vec3(radius)};
+    }
+
+    void grow(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void grow(const Aabb& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+
+    float surfaceArea() const {
+        glm::vec3 extent = max - min;
+        if (extent.x < 0.0f)
+            return 0.0f;
+        return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+};
+
+// 32 bytes, so two siblings share a cache line. Siblings are always stored
+// next to each other: an internal node only needs the index of its left child.
+struct BvhNode {
+    glm::vec3 boundsMin;
+    uint32_t leftOrFirst;   // Left child for internal nodes, first object for leaves
+    glm::vec3 boundsMax;
+    uint32_t objectCount;   // 0 for internal nodes
+
+    bool isLeaf() const { return objectCount > 0; }
+};
+
+const uint32_t BVH_MAX_LEAF_SIZE = 4;
+const uint32_t BVH_BIN_COUNT = 16;
+
+class Bvh {
+    public:
+        // Binned SAH build. With a pool, the top of the tree is split serially
+        // with parallel binning, then the remaining subtrees build in parallel.
+        void build(const std::vector<Aabb>& objectBounds, ThreadPool *pool = nullptr);
+
+        // Recomputes every node's bounds bottom-up, keeping the topology
+        void refit(const std::vector<Aabb>& objectBounds);
+        // Only touches the nodes above the objects that moved
+        void refit(const std::vector<Aabb>& objectBounds, const std::vector<uint32_t>& changedObjects);
+
+        void cullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+        bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, uint32_t *hitObject, float *hitDistance) const;
+
+        size_t nodeCount() const { return nodes.size(); }
+        size_t objectCount() const { return objectIndices.size(); }
+
+    private:
+        struct Subtree {
+            uint32_t node;
+            uint32_t first;
+            uint32_t count;
+        };
+
+        // The build partitions these directly instead of an index array,
+        // so that binning streams through memory rather than gathering
+        struct BuildItem {
+            Aabb bounds;
+            glm::vec3 centroid;
+            uint32_t object;
+        };
+
+        bool splitNode(const Subtree& subtree, Subtree& left, Subtree& right, ThreadPool *pool);
+        void buildSubtree(const Subtree& root);
+        void flatten();
+        void appendSubtree(uint32_t nodeIndex, std::vector<uint32_t>& out) const;
+
+        std::vector<BvhNode> nodes;
+        std::vector<uint32_t> objectIndices;
+        std::vector<uint32_t> parents;
+        std::vector<uint32_t> objectLeaves;
+        std::vector<uint32_t> objectSlots;
+        std::vector<uint8_t> refitMarks;
+        std::vector<uint32_t> refitNodes;
+        // Object bounds in tree order, parallel to objectIndices
+        std::vector<Aabb> bounds;
+
+        // Build scratch
+        std::vector<BuildItem> items;
+        std::atomic<uint32_t> nodesUsed{0};
+};
+
+#endif
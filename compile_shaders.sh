@@ -1,3 +1,7 @@
 ./vulkan/bin/glslc shaders/shader.vert -o shaders/vert.spv
-./vulkan/bin/glslc shaders/brightShader.frag -o shaders/bright.spv
-./vulkan/bin/glslc shaders/diffuseShader.frag -o shaders/diffuse.spv
+./vulkan/bin/glslc shaders/bindless.vert -o shaders/bindless.spv
+./vulkan/bin/glslc shaders/uber.frag -o shaders/uber.spv
+./vulkan/bin/glslc shaders/cull.comp -o shaders/cull.spv
+./vulkan/bin/glslc shaders/hiz.comp -o shaders/hiz.spv
+./vulkan/bin/glslc shaders/fullscreen.vert -o shaders/fullscreen.spv
+./vulkan/bin/glslc shaders/deferred.frag -o shaders/deferred.spv
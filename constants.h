@@ -4,6 +4,7 @@
 #include "vulkan/include/vulkan/vulkan.h"
 #include "app.h"
 
+#include <array>
 #include <string>
 #include <vector>
 
@@ -14,6 +15,65 @@ const std::string TITLE = "Vulkan";
 const std::vector<const char *> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
 };
+// Every ShaderProgram is a specialization of one fragment shader
+const std::array<ShaderVariant, END_OF_SHADERS> SHADER_VARIANTS = {{
+    {"diffuseShader", LIGHTING_UNLIT, 0, 0},
+    {"brightShader", LIGHTING_COOL, MAX_LIGHTS, 0}
+}};
+
+// Names for --present=, indexed by PresentPolicy
+const std::array<const char *, END_OF_PRESENT_POLICIES> PRESENT_POLICY_NAMES = {{
+    "latency", "power", "uncapped", "immediate"
+}};
+
+// The present modes each PresentPolicy tries, in order
+const std::array<std::vector<VkPresentModeKHR>, END_OF_PRESENT_POLICIES> PRESENT_MODE_PREFERENCES = {{
+    {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR},
+    {VK_PRESENT_MODE_FIFO_KHR},
+    {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR},
+    {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR}
+}};
+
+const std::string VERTEX_SHADER_FILE = "shaders/vert.spv";
+const std::string BINDLESS_VERTEX_SHADER_FILE = "shaders/bindless.spv";
+const std::string FRAGMENT_SHADER_FILE = "shaders/uber.spv";
+const std::string CULL_SHADER_FILE = "shaders/cull.spv";
+const std::string HIZ_SHADER_FILE = "shaders/hiz.spv";
+const std::string FULLSCREEN_SHADER_FILE = "shaders/fullscreen.spv";
+const std::string DEFERRED_SHADER_FILE = "shaders/deferred.spv";
+
+// GLSL source of each compiled shader, for --hot-reload
+const std::vector<std::pair<std::string, std::string>> SHADER_SOURCES = {
+    {"shaders/shader.vert", VERTEX_SHADER_FILE},
+    {"shaders/bindless.vert", BINDLESS_VERTEX_SHADER_FILE},
+    {"shaders/uber.frag", FRAGMENT_SHADER_FILE},
+    {"shaders/cull.comp", CULL_SHADER_FILE},
+    {"shaders/hiz.comp", HIZ_SHADER_FILE},
+    {"shaders/fullscreen.vert", FULLSCREEN_SHADER_FILE},
+    {"shaders/deferred.frag", DEFERRED_SHADER_FILE}
+};
+
+// Unlit, so its variant is the cheapest to build. Objects are drawn with it
+// while the variant they need is still being built.
+const ShaderProgram FALLBACK_SHADER = DIFFUSE_SHADER;
+
+// Upper limit for the buffers --bindless can register; devices may allow fewer
+const uint32_t BINDLESS_BUFFER_CAPACITY = 1024;
+
+// Upper limit for --point-lights
+const uint32_t MAX_POINT_LIGHTS = 1024;
+// Radians per second the point lights circle the scene's z axis at while
+// it is animated
+const float POINT_LIGHT_ORBIT_SPEED = 0.25f;
+
+// G-buffer of --deferred: the colour with the lighting model in alpha, and
+// the surface and view space normals, octahedron encoded
+const VkFormat GBUFFER_COLOR_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+const VkFormat GBUFFER_NORMALS_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+// Compiled pipelines are kept here between runs
+const std::string PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+
 const std::vector<const char *> deviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
@@ -52,7 +112,29 @@ const std::vector<uint16_t> indices = {
     6, 7, 3
 };
 
+// Of the mesh drawn with --sphere; 5120 triangles, enough for every LOD
+// level to halve
+const uint32_t SPHERE_SUBDIVISIONS = 4;
+
 const int MAX_FRAMES_IN_FLIGHT = 10;
 
+// Camera
+const glm::vec3 CAMERA_EYE = glm::vec3(2.0f, 2.0f, 2.0f);
+const glm::vec3 CAMERA_CENTER = glm::vec3(0.0f, 0.0f, 0.0f);
+const glm::vec3 CAMERA_UP = glm::vec3(0.0f, 0.0f, 1.0f);
+const float CAMERA_FOV = 45.0f;
+const float CAMERA_NEAR = 0.1f;
+const float CAMERA_FAR = 10.0f;
+
+// Scenes with at least this many objects are culled through the BVH
+const size_t BVH_CULLING_THRESHOLD = 1024;
+
+// Distance between the extra objects requested with --objects
+const float OBJECT_GRID_SPACING = 1.5f;
+
+// Must match local_size in shaders/cull.comp and shaders/hiz.comp
+const uint32_t CULL_WORKGROUP_SIZE = 64;
+const uint32_t HIZ_WORKGROUP_SIZE = 8;
+
 #endif
 
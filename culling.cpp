@@ -0,0 +1,188 @@
+#include "culling.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CULLING_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+typedef size_t (*CullRangeFn)(const BoundsSoA&, const Frustum&, size_t, size_t, uint32_t *);
+
+size_t cullRangeScalar(const BoundsSoA& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t *out) {
+    size_t count = 0;
+    for(size_t i = begin; i < end; i++) {
+        bool inside = true;
+        for(int p = 0; p < 6 && inside; p++) {
+            const glm::vec4& plane = frustum.planes[p];
+            float distance = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] + plane.z * bounds.centerZ[i] + plane.w;
+            inside = distance >= -bounds.radius[i];
+        }
+        if (inside)
+            out[count++] = static_cast<uint32_t>(i);
+    }
+    return count;
+}
+
+#ifdef CULLING_X86
+
+size_t cullRangeSSE(const BoundsSoA& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t *out) {
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for(int p = 0; p < 6; p++) {
+        planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+        planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+        planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+        planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+
+    size_t count = 0;
+    size_t i = begin;
+    for(; i + 4 <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 y = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 z = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 r = _mm_loadu_ps(&bounds.radius[i]);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p])
+            );
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, r), _mm_setzero_ps()));
+        }
+
+        unsigned mask = static_cast<unsigned>(_mm_movemask_ps(inside));
+        while (mask) {
+            out[count++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    return count + cullRangeScalar(bounds, frustum, i, end, out + count);
+}
+
+__attribute__((target("avx2,fma")))
+size_t cullRangeAVX2(const BoundsSoA& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t *out) {
+    __m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for(int p = 0; p < 6; p++) {
+        planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+        planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+        planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+        planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+
+    size_t count = 0;
+    size_t i = begin;
+    for(; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_loadu_ps(&bounds.centerX[i]);
+        __m256 y = _mm256_loadu_ps(&bounds.centerY[i]);
+        __m256 z = _mm256_loadu_ps(&bounds.centerZ[i]);
+        __m256 r = _mm256_loadu_ps(&bounds.radius[i]);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(int p = 0; p < 6; p++) {
+            // distance + radius, folded into the plane equation
+            __m256 distance = _mm256_fmadd_ps(planeX[p], x, _mm256_add_ps(planeW[p], r));
+            distance = _mm256_fmadd_ps(planeY[p], y, distance);
+            distance = _mm256_fmadd_ps(planeZ[p], z, distance);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(inside));
+        while (mask) {
+            out[count++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    return count + cullRangeScalar(bounds, frustum, i, end, out + count);
+}
+
+#endif
+
+CullRangeFn selectKernel(CullKernel kernel) {
+#ifdef CULLING_X86
+    if (kernel == CULL_KERNEL_AUTO)
+        kernel = cullKernelSupported(CULL_KERNEL_AVX2) ? CULL_KERNEL_AVX2 : CULL_KERNEL_SSE;
+
+    switch (kernel) {
+        case CULL_KERNEL_AVX2:
+            return cullRangeAVX2;
+        case CULL_KERNEL_SSE:
+            return cullRangeSSE;
+        default:
+            return cullRangeScalar;
+    }
+#else
+    return cullRangeScalar;
+#endif
+}
+
+}
+
+bool cullKernelSupported(CullKernel kernel) {
+    switch (kernel) {
+#ifdef CULLING_X86
+        case CULL_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case CULL_KERNEL_SSE:
+            return true;
+#else
+        case CULL_KERNEL_AVX2:
+        case CULL_KERNEL_SSE:
+            return false;
+#endif
+        default:
+            return true;
+    }
+}
+
+Frustum extractFrustum(const glm::mat4& viewProj) {
+    // Gribb/Hartmann: planes are sums and differences of the matrix rows
+    glm::vec4 rows[4];
+    for(int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];
+    frustum.planes[1] = rows[3] - rows[0];
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    frustum.planes[4] = rows[3] + rows[2];
+    frustum.planes[5] = rows[3] - rows[2];
+
+    for(auto& plane: frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+
+    return frustum;
+}
+
+void cullBounds(const BoundsSoA& bounds, const Frustum& frustum, std::vector<uint32_t>& visible, CullScratch& scratch, ThreadPool *pool, CullKernel kernel) {
+    CullRangeFn cullRange = selectKernel(kernel);
+    size_t count = bounds.size();
+    if (scratch.capacity < count) {
+        scratch.indices.reset(new uint32_t[count]);
+        scratch.capacity = count;
+    }
+    uint32_t *indices = scratch.indices.get();
+
+    visible.clear();
+    if (pool == nullptr || count <= CULL_CHUNK_SIZE) {
+        visible.insert(visible.end(), indices, indices + cullRange(bounds, frustum, 0, count, indices));
+        return;
+    }
+
+    // Every chunk compacts into its own slice of the scratch space, and the
+    // slices are then appended in order
+    size_t chunkCount = (count + CULL_CHUNK_SIZE - 1) / CULL_CHUNK_SIZE;
+    scratch.chunkCounts.resize(chunkCount);
+    pool->parallelFor(count, CULL_CHUNK_SIZE, [&](size_t begin, size_t end, size_t chunk) {
+        scratch.chunkCounts[chunk] = cullRange(bounds, frustum, begin, end, indices + begin);
+    });
+
+    for(size_t chunk = 0; chunk < chunkCount; chunk++) {
+        const uint32_t *slice = indices + chunk * CULL_CHUNK_SIZE;
+        visible.insert(visible.end(), slice, slice + scratch.chunkCounts[chunk]);
+    }
+}
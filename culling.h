@@ -0,0 +1,106 @@
+#ifndef VULKAN_CULLING_H
+#define VULKAN_CULLING_H
+
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Keeps SIMD loads of the bounds arrays on 32 byte boundaries
+template<typename T>
+struct AlignedAllocator {
+    typedef T value_type;
+    static const size_t alignment = 32;
+
+    AlignedAllocator() = default;
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T *allocate(size_t count) {
+        size_t bytes = ((count * sizeof(T) + alignment - 1) / alignment) * alignment;
+        void *ptr = aligned_alloc(alignment, bytes);
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, size_t) { free(ptr); }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Bounding spheres in structure-of-arrays form, so that 8 of them can be
+// tested against a plane with a handful of vector instructions
+struct BoundsSoA {
+    AlignedVector<float> centerX;
+    AlignedVector<float> centerY;
+    AlignedVector<float> centerZ;
+    AlignedVector<float> radius;
+
+    size_t size() const { return radius.size(); }
+
+    void resize(size_t count) {
+        centerX.resize(count);
+        centerY.resize(count);
+        centerZ.resize(count);
+        radius.resize(count);
+    }
+
+    void set(size_t index, const glm::vec3& center, float r) {
+        centerX[index] = center.x;
+        centerY[index] = center.y;
+        centerZ[index] = center.z;
+        radius[index] = r;
+    }
+
+    void push_back(const glm::vec3& center, float r) {
+        resize(size() + 1);
+        set(size() - 1, center, r);
+    }
+};
+
+// Plane equations with inward facing normals: a point p is inside
+// a plane when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+Frustum extractFrustum(const glm::mat4& viewProj);
+
+enum CullKernel {
+    CULL_KERNEL_AUTO,
+    CULL_KERNEL_SCALAR,
+    CULL_KERNEL_SSE,
+    CULL_KERNEL_AVX2
+};
+
+// Objects per parallel job; a multiple of 8 keeps every job on whole SIMD blocks
+const size_t CULL_CHUNK_SIZE = 16384;
+
+// Room for the chunks of cullBounds to compact indices into before they are
+// appended to the output. It is allocated without being zeroed and kept
+// across calls, so a call only pays for the objects that are visible.
+struct CullScratch {
+    std::unique_ptr<uint32_t[]> indices;
+    size_t capacity = 0;
+    std::vector<size_t> chunkCounts;
+};
+
+// Writes the indices of every sphere that intersects the frustum into
+// visible, in ascending order. Runs in parallel chunks when given a pool.
+void cullBounds(const BoundsSoA& bounds, const Frustum& frustum, std::vector<uint32_t>& visible, CullScratch& scratch, ThreadPool *pool = nullptr, CullKernel kernel = CULL_KERNEL_AUTO);
+
+bool cullKernelSupported(CullKernel kernel);
+
+#endif
@@ -0,0 +1,84 @@
+#include "descriptor_allocator.h"
+
+#include <stdexcept>
+
+void DescriptorAllocator::create(VkDevice device, uint32_t setCount, const std::vector<VkDescriptorPoolSize>& poolSizes) {
+    this->device = device;
+    this->setCount = setCount;
+    this->poolSizes = poolSizes;
+    freePools.push_back(createPool());
+}
+
+void DescriptorAllocator::destroy() {
+    for(auto pool: usedPools)
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    for(auto pool: freePools)
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    usedPools.clear();
+    freePools.clear();
+}
+
+VkDescriptorPool DescriptorAllocator::createPool() {
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = setCount;
+
+    VkDescriptorPool pool;
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create descriptor pool!");
+
+    // The next pool that has to be created is twice as large
+    setCount *= 2;
+    for(auto& poolSize: poolSizes)
+        poolSize.descriptorCount *= 2;
+    return pool;
+}
+
+VkDescriptorPool DescriptorAllocator::nextPool() {
+    if (freePools.empty())
+        return createPool();
+
+    VkDescriptorPool pool = freePools.back();
+    freePools.pop_back();
+    return pool;
+}
+
+void DescriptorAllocator::allocate(const std::vector<VkDescriptorSetLayout>& layouts, VkDescriptorSet *sets) {
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+    allocInfo.pSetLayouts = layouts.data();
+
+    if (usedPools.empty())
+        usedPools.push_back(nextPool());
+
+    // Give up once even a pool that is larger than any before can't hold
+    // the sets
+    bool grown = false;
+    while (true) {
+        allocInfo.descriptorPool = usedPools.back();
+        VkResult result = vkAllocateDescriptorSets(device, &allocInfo, sets);
+        if (result == VK_SUCCESS)
+            return;
+        if ((result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) || grown)
+            throw std::runtime_error("Failed to allocate descriptor sets!");
+
+        grown = freePools.empty();
+        usedPools.push_back(nextPool());
+    }
+}
+
+std::vector<VkDescriptorPool> DescriptorAllocator::retire() {
+    std::vector<VkDescriptorPool> pools;
+    pools.swap(usedPools);
+    return pools;
+}
+
+void DescriptorAllocator::recycle(const std::vector<VkDescriptorPool>& pools) {
+    for(auto pool: pools) {
+        vkResetDescriptorPool(device, pool, 0);
+        freePools.push_back(pool);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef VULKAN_DESCRIPTOR_ALLOCATOR_H
+#define VULKAN_DESCRIPTOR_ALLOCATOR_H
+
+#include "vulkan/include/vulkan/vulkan.h"
+
+#include <cstdint>
+#include <vector>
+
+// Allocates descriptor sets from a chain of pools. When the current pool
+// runs out, the next one is taken, growing the chain by a pool twice the
+// size of the last, so the app never has to know up front how many sets
+// it will need. Sets aren't freed one by one; retire() takes all of them
+// out of use at once and recycle() resets their pools for later sets.
+class DescriptorAllocator {
+    public:
+        // poolSizes are what setCount typical sets need; the first pool
+        // holds that many
+        void create(VkDevice device, uint32_t setCount, const std::vector<VkDescriptorPoolSize>& poolSizes);
+        void destroy();
+
+        // Allocates one set per layout, all from the same pool
+        void allocate(const std::vector<VkDescriptorSetLayout>& layouts, VkDescriptorSet *sets);
+
+        // Hands over the pools of every set allocated so far; later sets
+        // come from other pools. Give them back to recycle() once no
+        // pending command buffer uses their sets.
+        std::vector<VkDescriptorPool> retire();
+        void recycle(const std::vector<VkDescriptorPool>& pools);
+
+        // Pools that were retired and not recycled yet aren't counted
+        size_t getPoolCount() const { return usedPools.size() + freePools.size(); }
+
+    private:
+        VkDescriptorPool createPool();
+        VkDescriptorPool nextPool();
+
+        VkDevice device = VK_NULL_HANDLE;
+        uint32_t setCount = 0;
+        std::vector<VkDescriptorPoolSize> poolSizes;
+        // The last used pool is the one being allocated from
+        std::vector<VkDescriptorPool> usedPools;
+        std::vector<VkDescriptorPool> freePools;
+};
+
+#endif
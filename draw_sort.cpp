@@ -0,0 +1,102 @@
+#include "draw_sort.h"
+
+#include <array>
+
+namespace {
+
+const uint32_t RADIX_BITS = 8;
+const uint32_t RADIX_SIZE = 1 << RADIX_BITS;
+const uint32_t RADIX_PASSES = 64 / RADIX_BITS;
+
+typedef std::array<uint32_t, RADIX_SIZE> Histogram;
+
+inline uint32_t radixDigit(DrawKey key, uint32_t pass) {
+    return static_cast<uint32_t>(key >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1);
+}
+
+}
+
+void sortDraws(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch, ThreadPool *pool) {
+    size_t count = items.size();
+    if (count < 2)
+        return;
+    scratch.resize(count);
+
+    size_t chunkCount = (count + DRAW_SORT_CHUNK_SIZE - 1) / DRAW_SORT_CHUNK_SIZE;
+    auto forEachChunk = [&](auto&& body) {
+        if (pool) {
+            pool->parallelFor(count, DRAW_SORT_CHUNK_SIZE, body);
+            return;
+        }
+        for(size_t chunk = 0; chunk < chunkCount; chunk++) {
+            size_t begin = chunk * DRAW_SORT_CHUNK_SIZE;
+            body(begin, std::min(begin + DRAW_SORT_CHUNK_SIZE, count), chunk);
+        }
+    };
+
+    // One read over the keys counts the digits of every pass. That finds
+    // the passes that can be skipped, and already has the counts for the
+    // first pass, since nothing has moved yet.
+    std::vector<std::array<Histogram, RADIX_PASSES>> initialCounts(chunkCount);
+    forEachChunk([&](size_t begin, size_t end, size_t chunk) {
+        auto& counts = initialCounts[chunk];
+        for(auto& histogram: counts)
+            histogram.fill(0);
+        for(size_t i = begin; i < end; i++) {
+            DrawKey key = items[i].key;
+            for(uint32_t pass = 0; pass < RADIX_PASSES; pass++)
+                counts[pass][radixDigit(key, pass)]++;
+        }
+    });
+
+    std::vector<uint32_t> passes;
+    for(uint32_t pass = 0; pass < RADIX_PASSES; pass++) {
+        uint32_t digit = radixDigit(items[0].key, pass);
+        size_t sameDigit = 0;
+        for(const auto& counts: initialCounts)
+            sameDigit += counts[pass][digit];
+        if (sameDigit != count)
+            passes.push_back(pass);
+    }
+
+    std::vector<Histogram> chunkCounts(chunkCount);
+    std::vector<Histogram> chunkOffsets(chunkCount);
+    DrawItem *src = items.data();
+    DrawItem *dst = scratch.data();
+
+    for(size_t p = 0; p < passes.size(); p++) {
+        uint32_t pass = passes[p];
+
+        if (p == 0) {
+            for(size_t chunk = 0; chunk < chunkCount; chunk++)
+                chunkCounts[chunk] = initialCounts[chunk][pass];
+        } else {
+            forEachChunk([&](size_t begin, size_t end, size_t chunk) {
+                Histogram& counts = chunkCounts[chunk];
+                counts.fill(0);
+                for(size_t i = begin; i < end; i++)
+                    counts[radixDigit(src[i].key, pass)]++;
+            });
+        }
+
+        // Digit-major, chunk-minor offsets keep the sort stable
+        uint32_t offset = 0;
+        for(uint32_t digit = 0; digit < RADIX_SIZE; digit++) {
+            for(size_t chunk = 0; chunk < chunkCount; chunk++) {
+                chunkOffsets[chunk][digit] = offset;
+                offset += chunkCounts[chunk][digit];
+            }
+        }
+
+        forEachChunk([&](size_t begin, size_t end, size_t chunk) {
+            Histogram& offsets = chunkOffsets[chunk];
+            for(size_t i = begin; i < end; i++)
+                dst[offsets[radixDigit(src[i].key, pass)]++] = src[i];
+        });
+
+        std::swap(src, dst);
+    }
+
+    if (src != items.data())
+        items.swap(scratch);
+}
@@ -0,0 +1,52 @@
+#ifndef VULKAN_DRAW_SORT_H
+#define VULKAN_DRAW_SORT_H
+
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Sort key of a draw, with the state that is most expensive to change in
+// the most significant bits so that sorting groups draws by it:
+//   63..56  pipeline
+//   55..44  descriptor set
+//   43..34  mesh
+//   33..32  LOD level of the mesh
+//   31..0   depth, front to back
+typedef uint64_t DrawKey;
+
+const uint32_t DRAW_KEY_MAX_LODS = 4;
+
+inline DrawKey makeDrawKey(uint32_t pipeline, uint32_t descriptorSet, uint32_t mesh, uint32_t lod, float depth) {
+    // Non-negative floats order the same way as their bit patterns
+    depth = depth > 0.0f ? depth : 0.0f;
+    uint32_t depthBits;
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+
+    return (DrawKey(pipeline & 0xFF) << 56) |
+        (DrawKey(descriptorSet & 0xFFF) << 44) |
+        (DrawKey(mesh & 0x3FF) << 34) |
+        (DrawKey(lod & (DRAW_KEY_MAX_LODS - 1)) << 32) |
+        depthBits;
+}
+
+inline uint32_t drawKeyPipeline(DrawKey key) { return static_cast<uint32_t>(key >> 56); }
+inline uint32_t drawKeyDescriptorSet(DrawKey key) { return static_cast<uint32_t>(key >> 44) & 0xFFF; }
+inline uint32_t drawKeyMesh(DrawKey key) { return static_cast<uint32_t>(key >> 34) & 0x3FF; }
+inline uint32_t drawKeyLod(DrawKey key) { return static_cast<uint32_t>(key >> 32) & (DRAW_KEY_MAX_LODS - 1); }
+
+struct DrawItem {
+    DrawKey key;
+    uint32_t object;
+};
+
+const size_t DRAW_SORT_CHUNK_SIZE = 16384;
+
+// Stable LSD radix sort on the keys, a byte per pass. Bytes that are the
+// same in every key are skipped, so fields the scene doesn't vary cost
+// nothing. With a pool, each pass counts and scatters chunks in parallel.
+// scratch is resized as needed and is meant to be reused across frames.
+void sortDraws(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch, ThreadPool *pool = nullptr);
+
+#endif
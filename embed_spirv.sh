@@ -0,0 +1,41 @@
+#!/bin/sh
+# Turns compiled shaders into constexpr arrays, so they are part of the binary
+# Usage: embed_spirv.sh output.h shaders/a.spv shaders/b.spv ...
+set -e
+
+output=$1
+shift
+
+identifier() {
+    echo "$1" | tr 'a-z' 'A-Z' | tr -c 'A-Z0-9\n' '_'
+}
+
+{
+    echo "// Generated by embed_spirv.sh, do not edit"
+    echo "#ifndef VULKAN_EMBEDDED_SHADERS_H"
+    echo "#define VULKAN_EMBEDDED_SHADERS_H"
+    echo
+    echo "#include \"spirv.h\""
+    echo
+    for file in "$@"; do
+        if [ $(( $(wc -c < "$file") % 4 )) -ne 0 ]; then
+            echo "$file is not SPIR-V" >&2
+            exit 1
+        fi
+        # od prints host-endian words, the same as reading the file into
+        # uint32_t would
+        echo "constexpr uint32_t $(identifier "$file")[] = {"
+        od -An -v -tx4 "$file" | sed -e 's/ *\([0-9a-f]\{8\}\)/0x\1, /g' -e 's/^/    /' -e 's/, $/,/'
+        echo "};"
+        echo
+    done
+    echo "constexpr EmbeddedShader EMBEDDED_SHADERS[] = {"
+    for file in "$@"; do
+        name=$(identifier "$file")
+        echo "    {\"$file\", $name, sizeof($name) / sizeof(uint32_t)},"
+    done
+    echo "};"
+    echo
+    echo "#endif"
+} > "$output.tmp"
+mv "$output.tmp" "$output"
@@ -0,0 +1,84 @@
+#include "frame_limiter.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <time.h>
+
+// Bounds of the spin margin: even an idle system rarely wakes a sleeper
+// sooner than the lower one, and a longer spin than the upper one would
+// cost more CPU time than the limiter saves
+const std::chrono::microseconds MIN_SPIN_MARGIN(50);
+const std::chrono::microseconds MAX_SPIN_MARGIN(2000);
+
+void FrameLimiter::setTargetFps(double targetFps) {
+    if (targetFps <= 0.0) {
+        period = Clock::duration::zero();
+        return;
+    }
+
+    period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+    deadline = Clock::now() + period;
+    spinMargin = std::chrono::duration_cast<Clock::duration>(MAX_SPIN_MARGIN) / 2;
+}
+
+// steady_clock is CLOCK_MONOTONIC on Linux, so its time points can be
+// handed to clock_nanosleep as they are
+static void sleepUntil(FrameLimiter::Clock::time_point wakeup) {
+    auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(wakeup.time_since_epoch()).count();
+    timespec time;
+    time.tv_sec = static_cast<time_t>(sinceEpoch / 1000000000);
+    time.tv_nsec = static_cast<long>(sinceEpoch % 1000000000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr) == EINTR);
+}
+
+void FrameLimiter::beginFrame() {
+    auto now = Clock::now();
+    sleepMs = 0.0;
+    spinMs = 0.0;
+    if (!enabled()) {
+        frameStart = now;
+        return;
+    }
+
+    // After a stall, start over from now instead of rushing through
+    // frames to catch up with the missed ticks
+    if (now > deadline + period)
+        deadline = now + predictedCost;
+
+    auto start = deadline - predictedCost;
+    auto wakeup = start - spinMargin;
+    if (now < wakeup) {
+        sleepUntil(wakeup);
+        auto woken = Clock::now();
+        auto overshoot = woken - wakeup;
+        sleepMs = std::chrono::duration<double, std::milli>(woken - now).count();
+        now = woken;
+
+        // Jump up to a new worst case right away, but only slowly forget it
+        spinMargin = std::max<Clock::duration>(overshoot + overshoot / 4, spinMargin - spinMargin / 32);
+        spinMargin = std::clamp<Clock::duration>(spinMargin, MIN_SPIN_MARGIN, MAX_SPIN_MARGIN);
+    }
+
+    auto spinStart = now;
+    while (now < start)
+        now = Clock::now();
+    spinMs = std::chrono::duration<double, std::milli>(now - spinStart).count();
+
+    frameStart = now;
+}
+
+void FrameLimiter::endFrame() {
+    if (!enabled())
+        return;
+
+    // A moving average smooths out single slow frames, which would
+    // otherwise shift the start of every following one
+    auto cost = Clock::now() - frameStart;
+    if (predictedCost == Clock::duration::zero())
+        predictedCost = cost;
+    else
+        predictedCost += (cost - predictedCost) / 8;
+    predictedCost = std::min(predictedCost, period);
+    deadline += period;
+}
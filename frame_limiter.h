@@ -0,0 +1,42 @@
+#ifndef VULKAN_FRAME_LIMITER_H
+#define VULKAN_FRAME_LIMITER_H
+
+#include <chrono>
+
+// Caps the frame rate for present modes that don't block, e.g. mailbox and
+// immediate. Each frame is started late enough that, given the predicted
+// cost of its work, it ends on the next tick of the target rate. The wait
+// sleeps with clock_nanosleep until shortly before that start and spins
+// the rest, since a sleep alone overshoots by the scheduler's wakeup
+// latency; the spin margin follows the largest recent overshoot.
+class FrameLimiter {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        // A target of 0 disables the limiter
+        FrameLimiter(double targetFps = 0.0) { setTargetFps(targetFps); }
+
+        void setTargetFps(double targetFps);
+        bool enabled() const { return period.count() > 0; }
+
+        // Blocks until the next frame should start
+        void beginFrame();
+        // Marks the frame's work as done, which refines the cost prediction
+        void endFrame();
+
+        // Time spent in the last beginFrame()
+        double getSleepMs() const { return sleepMs; }
+        double getSpinMs() const { return spinMs; }
+        double getPredictedCostMs() const { return std::chrono::duration<double, std::milli>(predictedCost).count(); }
+
+    private:
+        Clock::duration period = Clock::duration::zero();
+        Clock::time_point deadline;     // When the current frame should end
+        Clock::time_point frameStart;
+        Clock::duration predictedCost = Clock::duration::zero();
+        Clock::duration spinMargin;
+        double sleepMs = 0.0;
+        double spinMs = 0.0;
+};
+
+#endif
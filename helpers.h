@@ -7,7 +7,6 @@
 #include <iostream>
 #include <stdexcept>
 #include <vector>
-#include <fstream>
 
 VkResult createDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT *pCreateInfo, const VkAllocationCallbacks *pAllocator, VkDebugUtilsMessengerEXT *pDebugMessenger) {
     auto func = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(
@@ -37,21 +36,43 @@ VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>
     return availableFormats[0];
 }
 
-VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
-    for(const auto& availablePresentMode: availablePresentModes) {
-        if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-            return availablePresentMode;
+// The first of the preferred modes that is available. FIFO is the fallback
+// since every device supports it.
+VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes, const std::vector<VkPresentModeKHR>& preferredPresentModes) {
+    for(const auto& preferredPresentMode: preferredPresentModes) {
+        for(const auto& availablePresentMode: availablePresentModes) {
+            if (availablePresentMode == preferredPresentMode)
+                return availablePresentMode;
+        }
     }
 
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+const char *presentModeName(VkPresentModeKHR presentMode) {
+    switch (presentMode) {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR:
+            return "immediate";
+        case VK_PRESENT_MODE_MAILBOX_KHR:
+            return "mailbox";
+        case VK_PRESENT_MODE_FIFO_KHR:
+            return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+            return "fifo relaxed";
+        default:
+            return "other";
+    }
+}
+
 VkExtent2D chooseSwapExtent(Window *window, const VkSurfaceCapabilitiesKHR& capabilities) {
     if (capabilities.currentExtent.width != UINT32_MAX)
         return capabilities.currentExtent;
 
+    // A minimized window has no size; wait for it to be restored
     int width = 0, height = 0;
+    window->getFramebufferSize(&width, &height);
     while (width == 0 || height == 0) {
+        window->waitEvents();
         window->getFramebufferSize(&width, &height);
     }
 
@@ -78,22 +99,6 @@ VkExtent2D chooseSwapExtent(Window *window, const VkSurfaceCapabilitiesKHR& capa
     return actualExtent;
 }
 
-std::vector<char> readBinary(const std::string& fileName) {
-    std::ifstream file(fileName, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open())
-        throw std::runtime_error("Failed to open binary file!");
-
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<char> buffer(fileSize);
-
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-    file.close();
-
-    return buffer;
-}
-
 inline void handleVkResult(VkResult result, const char *message) {
     if (result != VK_SUCCESS)
         throw std::runtime_error(message);
@@ -109,20 +114,6 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
         return VK_FALSE;
 }
 
-VkShaderModule createShaderModule(const VkDevice& device, const std::string& fileName) {
-    auto shaderCode = readBinary(fileName);
-
-    VkShaderModuleCreateInfo createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = shaderCode.size();
-    createInfo.pCode = reinterpret_cast<const uint32_t *>(shaderCode.data());
-
-    VkShaderModule shaderModule;
-    handleVkResult(vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule), "Failed to create Shader Module!");
-
-    return shaderModule;
-}
-
 uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
     VkPhysicalDeviceMemoryProperties memProperties;
     vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
@@ -135,6 +126,20 @@ uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, Vk
     throw std::runtime_error("Failed to find suitable memory type!");
 }
 
+// For attachments that never leave a render pass: lazily allocated memory
+// where the GPU has it, which tilers never have to back at all, else
+// ordinary device memory
+VkMemoryPropertyFlags transientMemoryProperties(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    for(uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if (memProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+            return VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    }
+    return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
+
 void createBuffer(VkPhysicalDevice& physicalDevice, VkDevice& device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -157,5 +162,67 @@ void createBuffer(VkPhysicalDevice& physicalDevice, VkDevice& device, VkDeviceSi
     vkBindBufferMemory(device, buffer, bufferMemory, 0);
 }
 
-#endif
+VkFormat findSupportedFormat(VkPhysicalDevice physicalDevice, const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
+    for(VkFormat format: candidates) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+
+        if (tiling == VK_IMAGE_TILING_LINEAR && (properties.linearTilingFeatures & features) == features)
+            return format;
+        if (tiling == VK_IMAGE_TILING_OPTIMAL && (properties.optimalTilingFeatures & features) == features)
+            return format;
+    }
+
+    throw std::runtime_error("Failed to find supported format!");
+}
+
+void createImage(VkPhysicalDevice& physicalDevice, VkDevice& device, uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = width;
+    imageInfo.extent.height = height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = usage;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    handleVkResult(vkCreateImage(device, &imageInfo, nullptr, &image), "Failed to create image!");
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(device, image, &memReqs);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memReqs.size;
+    allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memReqs.memoryTypeBits, properties);
+
+    handleVkResult(vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory), "Failed to allocate Image Memory!");
 
+    vkBindImageMemory(device, image, imageMemory, 0);
+}
+
+VkImageView createImageView(VkDevice& device, VkImage image, VkFormat format, VkImageAspectFlags aspectMask, uint32_t baseMipLevel, uint32_t levelCount) {
+    VkImageViewCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    createInfo.image = image;
+    createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    createInfo.format = format;
+    createInfo.subresourceRange.aspectMask = aspectMask;
+    createInfo.subresourceRange.baseMipLevel = baseMipLevel;
+    createInfo.subresourceRange.levelCount = levelCount;
+    createInfo.subresourceRange.baseArrayLayer = 0;
+    createInfo.subresourceRange.layerCount = 1;
+
+    VkImageView imageView;
+    handleVkResult(vkCreateImageView(device, &createInfo, nullptr, &imageView), "Failed to create an ImageView!");
+
+    return imageView;
+}
+
+#endif
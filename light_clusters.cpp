@@ -0,0 +1,112 @@
+#include "light_clusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+void LightClusters::setProjection(float fovY, float aspect, float near, float far) {
+    float logRatio = std::log(far / near);
+    sliceScale = CLUSTER_COUNT_Z / logRatio;
+    sliceBias = -CLUSTER_COUNT_Z * std::log(near) / logRatio;
+
+    // View space looks down -z; at depth d, the screen spans
+    // [-d * tanX, d * tanX] horizontally with y going down
+    float tanY = std::tan(fovY * 0.5f);
+    float tanX = tanY * aspect;
+
+    bounds.resize(CLUSTER_COUNT);
+    for(uint32_t z = 0; z < CLUSTER_COUNT_Z; z++) {
+        float sliceNear = near * std::pow(far / near, float(z) / CLUSTER_COUNT_Z);
+        float sliceFar = near * std::pow(far / near, float(z + 1) / CLUSTER_COUNT_Z);
+        for(uint32_t y = 0; y < CLUSTER_COUNT_Y; y++) {
+            float top = 1.0f - 2.0f * y / CLUSTER_COUNT_Y;
+            float bottom = 1.0f - 2.0f * (y + 1) / CLUSTER_COUNT_Y;
+            for(uint32_t x = 0; x < CLUSTER_COUNT_X; x++) {
+                float left = -1.0f + 2.0f * x / CLUSTER_COUNT_X;
+                float right = -1.0f + 2.0f * (x + 1) / CLUSTER_COUNT_X;
+
+                Aabb& box = bounds[(z * CLUSTER_COUNT_Y + y) * CLUSTER_COUNT_X + x];
+                box = Aabb();
+                for(float depth: {sliceNear, sliceFar}) {
+                    for(float sx: {left, right}) {
+                        for(float sy: {top, bottom})
+                            box.grow(glm::vec3(sx * depth * tanX, sy * depth * tanY, -depth));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Squared distance from a value to a range, along one axis
+static float axisDistance2(float value, float min, float max) {
+    float distance = std::max(0.0f, std::max(min - value, value - max));
+    return distance * distance;
+}
+
+void LightClusters::build(const std::vector<PointLight>& lights, ThreadPool *pool) {
+    clusters.resize(CLUSTER_COUNT);
+    sliceIndices.resize(CLUSTER_COUNT_Z);
+
+    const uint32_t slicePitch = CLUSTER_COUNT_X * CLUSTER_COUNT_Y;
+    auto buildSlices = [&](size_t begin, size_t end, size_t) {
+        std::vector<uint32_t> counts(slicePitch);
+        std::vector<uint32_t> scratch(slicePitch * MAX_LIGHTS_PER_CLUSTER);
+        float columnDistances[CLUSTER_COUNT_X];
+        float rowDistances[CLUSTER_COUNT_Y];
+
+        for(size_t z = begin; z < end; z++) {
+            // A cluster's box spans the same x range as every other one in
+            // its column, and the same y range as the rest of its row, so
+            // the distance from a light to it adds up from per column, per
+            // row and per slice terms
+            const Aabb *sliceBounds = &bounds[z * slicePitch];
+            std::fill(counts.begin(), counts.end(), 0);
+
+            for(uint32_t light = 0; light < lights.size(); light++) {
+                const glm::vec3& center = lights[light].position;
+                float radius2 = lights[light].range * lights[light].range;
+                float sliceDistance = axisDistance2(center.z, sliceBounds[0].min.z, sliceBounds[0].max.z);
+                if (sliceDistance > radius2)
+                    continue;
+
+                for(uint32_t x = 0; x < CLUSTER_COUNT_X; x++)
+                    columnDistances[x] = axisDistance2(center.x, sliceBounds[x].min.x, sliceBounds[x].max.x);
+                for(uint32_t y = 0; y < CLUSTER_COUNT_Y; y++)
+                    rowDistances[y] = axisDistance2(center.y, sliceBounds[y * CLUSTER_COUNT_X].min.y, sliceBounds[y * CLUSTER_COUNT_X].max.y);
+
+                for(uint32_t y = 0; y < CLUSTER_COUNT_Y; y++) {
+                    float rowDistance = sliceDistance + rowDistances[y];
+                    if (rowDistance > radius2)
+                        continue;
+                    for(uint32_t x = 0; x < CLUSTER_COUNT_X; x++) {
+                        uint32_t cluster = y * CLUSTER_COUNT_X + x;
+                        if (rowDistance + columnDistances[x] <= radius2 && counts[cluster] < MAX_LIGHTS_PER_CLUSTER)
+                            scratch[cluster * MAX_LIGHTS_PER_CLUSTER + counts[cluster]++] = light;
+                    }
+                }
+            }
+
+            // Offsets are relative to the slice until it's concatenated
+            std::vector<uint32_t>& indices = sliceIndices[z];
+            indices.clear();
+            for(uint32_t cluster = 0; cluster < slicePitch; cluster++) {
+                clusters[z * slicePitch + cluster] = {static_cast<uint32_t>(indices.size()), counts[cluster]};
+                const uint32_t *first = &scratch[cluster * MAX_LIGHTS_PER_CLUSTER];
+                indices.insert(indices.end(), first, first + counts[cluster]);
+            }
+        }
+    };
+
+    if (pool == nullptr)
+        buildSlices(0, CLUSTER_COUNT_Z, 0);
+    else
+        pool->parallelFor(CLUSTER_COUNT_Z, 1, buildSlices);
+
+    lightIndices.clear();
+    for(uint32_t z = 0; z < CLUSTER_COUNT_Z; z++) {
+        uint32_t sliceOffset = static_cast<uint32_t>(lightIndices.size());
+        for(uint32_t cluster = 0; cluster < slicePitch; cluster++)
+            clusters[z * slicePitch + cluster].offset += sliceOffset;
+        lightIndices.insert(lightIndices.end(), sliceIndices[z].begin(), sliceIndices[z].end());
+    }
+}
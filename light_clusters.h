@@ -0,0 +1,79 @@
+#ifndef VULKAN_LIGHT_CLUSTERS_H
+#define VULKAN_LIGHT_CLUSTERS_H
+
+#include "bvh.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// The view frustum is split into screen tiles and depth slices whose
+// thickness grows with distance, so clusters are roughly cube shaped all
+// the way to the far plane. Must match shaders/uber.frag and
+// shaders/deferred.frag.
+const uint32_t CLUSTER_COUNT_X = 16;
+const uint32_t CLUSTER_COUNT_Y = 9;
+const uint32_t CLUSTER_COUNT_Z = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z;
+
+// Bounds the work per fragment; further lights in a crowded cluster are
+// dropped
+const uint32_t MAX_LIGHTS_PER_CLUSTER = 32;
+
+// A point or spot light as the fragment shader reads it, in view space;
+// std430
+struct PointLight {
+    glm::vec3 position;
+    float range;                // Its light fades out to nothing here
+    glm::vec3 color;
+    float spotOuterCos;         // Cosine of the angle the spot cone ends at
+    glm::vec3 direction;        // Of the spot's axis
+    float spotInnerCos;         // Full intensity inside this angle
+
+    // A point light is a spot whose cone covers every direction
+    static PointLight point(const glm::vec3& position, float range, const glm::vec3& color) {
+        return {position, range, color, -2.0f, glm::vec3(0.0f, 0.0f, -1.0f), -1.0f};
+    }
+};
+
+// Where a cluster's lights are in the index list; std430
+struct LightCluster {
+    uint32_t offset;
+    uint32_t count;
+};
+
+// Assigns lights to the clusters of a view frustum they may reach
+class LightClusters {
+    public:
+        // Recomputes the clusters' bounds; their depth slices are spread
+        // logarithmically between the near and far planes
+        void setProjection(float fovY, float aspect, float near, float far);
+
+        // A fragment at view space depth d is in slice
+        // floor(log(d) * sliceScale + sliceBias)
+        float getSliceScale() const { return sliceScale; }
+        float getSliceBias() const { return sliceBias; }
+
+        // Lights are in view space. Slices are processed in parallel when
+        // given a pool.
+        void build(const std::vector<PointLight>& lights, ThreadPool *pool = nullptr);
+
+        // Indexed by (z * CLUSTER_COUNT_Y + y) * CLUSTER_COUNT_X + x, with y
+        // going down the screen
+        const std::vector<LightCluster>& getClusters() const { return clusters; }
+        const std::vector<uint32_t>& getLightIndices() const { return lightIndices; }
+
+    private:
+        std::vector<Aabb> bounds;
+        float sliceScale = 0.0f;
+        float sliceBias = 0.0f;
+
+        std::vector<LightCluster> clusters;
+        std::vector<uint32_t> lightIndices;
+        // Built per slice, then concatenated
+        std::vector<std::vector<uint32_t>> sliceIndices;
+};
+
+#endif
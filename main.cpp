@@ -1,24 +1,67 @@
+#include <algorithm>
+#include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <string>
 
 #include "constants.h"
 #include "app.h"
 
 int main(int argc, char **argv) {
-    ShaderProgram shaderProgram = DIFFUSE_SHADER;
+    AppConfig config;
 
-    if (argc >= 2) {
-        auto shaderProgramName = argv[1];
-        for (ShaderProgram program = ShaderProgram::DIFFUSE_SHADER; program != ShaderProgram::END_OF_SHADERS; program = static_cast<ShaderProgram>(program + 1)) {
-            if (validateShaderName(program, shaderProgramName)) {
-                shaderProgram = program;
-                break;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--gpu-culling")
+            config.gpuCulling = true;
+        else if (arg == "--occlusion-culling") {
+            config.gpuCulling = true;
+            config.occlusionCulling = true;
+        } else if (arg == "--mixed-shaders")
+            config.mixedShaders = true;
+        else if (arg == "--bindless")
+            config.bindless = true;
+        else if (arg == "--stats")
+            config.stats = true;
+        else if (arg == "--hot-reload")
+            config.hotReload = true;
+        else if (arg == "--object-data=push")
+            config.objectData = OBJECT_DATA_PUSH;
+        else if (arg == "--object-data=dynamic")
+            config.objectData = OBJECT_DATA_DYNAMIC;
+        else if (arg == "--object-data=instance")
+            config.objectData = OBJECT_DATA_INSTANCE;
+        else if (arg.rfind("--present=", 0) == 0) {
+            auto name = std::find(PRESENT_POLICY_NAMES.begin(), PRESENT_POLICY_NAMES.end(), arg.substr(strlen("--present=")));
+            if (name != PRESENT_POLICY_NAMES.end())
+                config.presentPolicy = static_cast<PresentPolicy>(name - PRESENT_POLICY_NAMES.begin());
+        } else if (arg == "--sphere")
+            config.sphereMesh = true;
+        else if (arg == "--deferred")
+            config.deferred = true;
+        else if (arg == "--on-demand")
+            config.onDemand = true;
+        else if (arg.rfind("--fps=", 0) == 0)
+            config.targetFps = std::max(0.0, std::atof(arg.c_str() + strlen("--fps=")));
+        else if (arg.rfind("--lights=", 0) == 0)
+            config.lightCount = static_cast<uint32_t>(std::min<int>(MAX_LIGHTS, std::max(0, std::atoi(arg.c_str() + strlen("--lights=")))));
+        else if (arg.rfind("--point-lights=", 0) == 0)
+            config.pointLightCount = static_cast<uint32_t>(std::min<int>(MAX_POINT_LIGHTS, std::max(0, std::atoi(arg.c_str() + strlen("--point-lights=")))));
+        else if (arg.rfind("--objects=", 0) == 0)
+            config.objectCount = static_cast<uint32_t>(std::max(1, std::atoi(arg.c_str() + strlen("--objects="))));
+        else {
+            for (ShaderProgram program = ShaderProgram::DIFFUSE_SHADER; program != ShaderProgram::END_OF_SHADERS; program = static_cast<ShaderProgram>(program + 1)) {
+                if (validateShaderName(program, arg.c_str())) {
+                    config.shaderProgram = program;
+                    break;
+                }
             }
         }
     }
 
     try {
-        ShadedCubeApp app(shaderProgram);
+        ShadedCubeApp app(config);
         app.run();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,307 @@
+#include "mesh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <queue>
+#include <stdexcept>
+
+namespace {
+
+// Symmetric 4x4 matrix, stored as its upper triangle
+struct Quadric {
+    double a[10] = {};
+
+    static Quadric fromPlane(double nx, double ny, double nz, double d) {
+        Quadric q;
+        q.a[0] = nx * nx; q.a[1] = nx * ny; q.a[2] = nx * nz; q.a[3] = nx * d;
+        q.a[4] = ny * ny; q.a[5] = ny * nz; q.a[6] = ny * d;
+        q.a[7] = nz * nz; q.a[8] = nz * d;
+        q.a[9] = d * d;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& other) {
+        for(int i = 0; i < 10; i++)
+            a[i] += other.a[i];
+        return *this;
+    }
+
+    double evaluate(const glm::vec3& v) const {
+        double x = v.x, y = v.y, z = v.z;
+        return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+             + a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+             + a[7]*z*z + 2*a[8]*z
+             + a[9];
+    }
+};
+
+struct Collapse {
+    double cost;
+    uint32_t from, to;
+    uint32_t fromStamp, toStamp;
+
+    bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+glm::vec3 triangleNormal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    return glm::cross(b - a, c - a);
+}
+
+}
+
+std::vector<uint16_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices, size_t targetIndexCount, float maxError, float *resultError) {
+    size_t vertexCount = vertices.size();
+    size_t triangleCount = indices.size() / 3;
+
+    std::vector<uint32_t> triangles(indices.begin(), indices.end());
+    std::vector<bool> triangleAlive(triangleCount, true);
+    std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+    std::vector<Quadric> quadrics(vertexCount);
+    std::vector<uint32_t> stamps(vertexCount, 0);
+    std::vector<bool> collapsed(vertexCount, false);
+
+    for(size_t t = 0; t < triangleCount; t++) {
+        const glm::vec3& p0 = vertices[triangles[t*3 + 0]].pos;
+        const glm::vec3& p1 = vertices[triangles[t*3 + 1]].pos;
+        const glm::vec3& p2 = vertices[triangles[t*3 + 2]].pos;
+
+        glm::vec3 normal = triangleNormal(p0, p1, p2);
+        float length = glm::length(normal);
+        if (length > 0.0f)
+            normal /= length;
+
+        Quadric plane = Quadric::fromPlane(normal.x, normal.y, normal.z, -glm::dot(normal, p0));
+        for(int k = 0; k < 3; k++) {
+            quadrics[triangles[t*3 + k]] += plane;
+            vertexTriangles[triangles[t*3 + k]].push_back(static_cast<uint32_t>(t));
+        }
+    }
+
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+    auto pushEdge = [&](uint32_t u, uint32_t v) {
+        Quadric q = quadrics[u];
+        q += quadrics[v];
+        double costToV = q.evaluate(vertices[v].pos);
+        double costToU = q.evaluate(vertices[u].pos);
+        if (costToV <= costToU)
+            heap.push({costToV, u, v, stamps[u], stamps[v]});
+        else
+            heap.push({costToU, v, u, stamps[v], stamps[u]});
+    };
+
+    for(size_t t = 0; t < triangleCount; t++) {
+        for(int k = 0; k < 3; k++) {
+            uint32_t u = triangles[t*3 + k];
+            uint32_t v = triangles[t*3 + (k+1) % 3];
+            if (u < v)
+                pushEdge(u, v);
+        }
+    }
+
+    size_t liveTriangles = triangleCount;
+    double maxCost = static_cast<double>(maxError) * maxError;
+    double worstCost = 0.0;
+
+    while (liveTriangles * 3 > targetIndexCount && !heap.empty()) {
+        Collapse c = heap.top();
+        heap.pop();
+
+        if (collapsed[c.from] || collapsed[c.to] || stamps[c.from] != c.fromStamp || stamps[c.to] != c.toStamp)
+            continue;
+        if (c.cost > maxCost)
+            break;
+
+        // Reject collapses that would flip a surviving triangle
+        bool flips = false;
+        for(uint32_t t: vertexTriangles[c.from]) {
+            if (!triangleAlive[t])
+                continue;
+
+            uint32_t *tri = &triangles[t*3];
+            if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+                continue;
+
+            glm::vec3 before = triangleNormal(vertices[tri[0]].pos, vertices[tri[1]].pos, vertices[tri[2]].pos);
+            glm::vec3 moved[3];
+            for(int k = 0; k < 3; k++)
+                moved[k] = vertices[tri[k] == c.from ? c.to : tri[k]].pos;
+            glm::vec3 after = triangleNormal(moved[0], moved[1], moved[2]);
+
+            if (glm::dot(before, after) <= 0.0f) {
+                flips = true;
+                break;
+            }
+        }
+        if (flips)
+            continue;
+
+        collapsed[c.from] = true;
+        quadrics[c.to] += quadrics[c.from];
+        stamps[c.to]++;
+        worstCost = std::max(worstCost, c.cost);
+
+        for(uint32_t t: vertexTriangles[c.from]) {
+            if (!triangleAlive[t])
+                continue;
+
+            uint32_t *tri = &triangles[t*3];
+            for(int k = 0; k < 3; k++) {
+                if (tri[k] == c.from)
+                    tri[k] = c.to;
+            }
+
+            if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) {
+                triangleAlive[t] = false;
+                liveTriangles--;
+            } else
+                vertexTriangles[c.to].push_back(t);
+        }
+        vertexTriangles[c.from].clear();
+
+        for(uint32_t t: vertexTriangles[c.to]) {
+            if (!triangleAlive[t])
+                continue;
+            for(int k = 0; k < 3; k++) {
+                if (triangles[t*3 + k] != c.to)
+                    pushEdge(c.to, triangles[t*3 + k]);
+            }
+        }
+    }
+
+    std::vector<uint16_t> result;
+    result.reserve(liveTriangles * 3);
+    for(size_t t = 0; t < triangleCount; t++) {
+        if (!triangleAlive[t])
+            continue;
+        for(int k = 0; k < 3; k++)
+            result.push_back(static_cast<uint16_t>(triangles[t*3 + k]));
+    }
+
+    if (resultError != nullptr)
+        *resultError = static_cast<float>(std::sqrt(worstCost));
+
+    return result;
+}
+
+void buildSphere(uint32_t subdivisions, std::vector<Vertex>& vertices, std::vector<uint16_t>& indices) {
+    const float t = (1.0f + std::sqrt(5.0f)) * 0.5f;
+    std::vector<glm::vec3> positions = {
+        {-1.0f, t, 0.0f}, {1.0f, t, 0.0f}, {-1.0f, -t, 0.0f}, {1.0f, -t, 0.0f},
+        {0.0f, -1.0f, t}, {0.0f, 1.0f, t}, {0.0f, -1.0f, -t}, {0.0f, 1.0f, -t},
+        {t, 0.0f, -1.0f}, {t, 0.0f, 1.0f}, {-t, 0.0f, -1.0f}, {-t, 0.0f, 1.0f}
+    };
+    std::vector<uint32_t> triangles = {
+        0, 11, 5,   0, 5, 1,    0, 1, 7,    0, 7, 10,   0, 10, 11,
+        1, 5, 9,    5, 11, 4,   11, 10, 2,  10, 7, 6,   7, 1, 8,
+        3, 9, 4,    3, 4, 2,    3, 2, 6,    3, 6, 8,    3, 8, 9,
+        4, 9, 5,    2, 4, 11,   6, 2, 10,   8, 6, 7,    9, 8, 1
+    };
+    for(auto& position: positions)
+        position = glm::normalize(position);
+
+    for(uint32_t level = 0; level < subdivisions; level++) {
+        // Triangles sharing an edge share the vertex at its midpoint
+        std::map<std::pair<uint32_t, uint32_t>, uint32_t> midpoints;
+        auto midpoint = [&](uint32_t a, uint32_t b) {
+            auto edge = std::make_pair(std::min(a, b), std::max(a, b));
+            auto found = midpoints.find(edge);
+            if (found != midpoints.end())
+                return found->second;
+            uint32_t index = static_cast<uint32_t>(positions.size());
+            positions.push_back(glm::normalize(positions[a] + positions[b]));
+            midpoints[edge] = index;
+            return index;
+        };
+
+        std::vector<uint32_t> subdivided;
+        subdivided.reserve(triangles.size() * 4);
+        for(size_t i = 0; i < triangles.size(); i += 3) {
+            uint32_t a = triangles[i], b = triangles[i + 1], c = triangles[i + 2];
+            uint32_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            subdivided.insert(subdivided.end(), {a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca});
+        }
+        triangles = std::move(subdivided);
+    }
+
+    if (positions.size() > UINT16_MAX)
+        throw std::runtime_error("Too many sphere subdivisions for 16 bit indices!");
+
+    vertices.clear();
+    for(const auto& normal: positions)
+        vertices.push_back({normal * 0.5f, normal * 0.5f + glm::vec3(0.5f), normal});
+    indices.assign(triangles.begin(), triangles.end());
+}
+
+float lodErrorBudget(float radius, uint32_t level) {
+    if (level == 0)
+        return 0.0f;
+
+    return radius * LOD_ERROR_BUDGET * static_cast<float>(1u << (level - 1));
+}
+
+LodChain buildLodChain(const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices, uint32_t maxLevels) {
+    LodChain chain = {};
+
+    glm::vec3 minPos(FLT_MAX), maxPos(-FLT_MAX);
+    for(const auto& vertex: vertices) {
+        minPos = glm::min(minPos, vertex.pos);
+        maxPos = glm::max(maxPos, vertex.pos);
+    }
+    chain.center = (minPos + maxPos) * 0.5f;
+    chain.radius = 0.0f;
+    for(const auto& vertex: vertices)
+        chain.radius = std::max(chain.radius, glm::length(vertex.pos - chain.center));
+
+    chain.indices = indices;
+    chain.lods.push_back({0, static_cast<uint32_t>(indices.size()), 0.0f});
+
+    std::vector<uint16_t> previous = indices;
+    for(uint32_t level = 1; level < maxLevels; level++) {
+        size_t target = (previous.size() / 6) * 3;
+        if (target < 3)
+            break;
+
+        float error = 0.0f;
+        auto simplified = simplifyMesh(vertices, previous, target, lodErrorBudget(chain.radius, level), &error);
+        if (simplified.empty() || simplified.size() >= previous.size())
+            break;
+
+        MeshLod lod = {};
+        lod.firstIndex = static_cast<uint32_t>(chain.indices.size());
+        lod.indexCount = static_cast<uint32_t>(simplified.size());
+        lod.error = std::max(error, chain.lods.back().error);
+        chain.lods.push_back(lod);
+        chain.indices.insert(chain.indices.end(), simplified.begin(), simplified.end());
+
+        previous = std::move(simplified);
+    }
+
+    return chain;
+}
+
+float projectedSize(float radius, float distance, float fovY, float viewportHeight) {
+    if (distance <= radius)
+        return FLT_MAX;
+
+    return radius * viewportHeight / (distance * std::tan(fovY * 0.5f));
+}
+
+float LodSelector::threshold(uint32_t level) const {
+    return finestSize / static_cast<float>(1u << level);
+}
+
+uint32_t LodSelector::select(float screenSize, uint32_t currentLevel, uint32_t levelCount) const {
+    if (levelCount == 0)
+        return 0;
+
+    uint32_t level = std::min(currentLevel, levelCount - 1);
+
+    while (level + 1 < levelCount && screenSize < threshold(level) * (1.0f - hysteresis))
+        level++;
+    while (level > 0 && screenSize > threshold(level - 1) * (1.0f + hysteresis))
+        level--;
+
+    return level;
+}
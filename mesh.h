@@ -0,0 +1,111 @@
+#ifndef VULKAN_MESH_H
+#define VULKAN_MESH_H
+
+#include "vulkan/include/vulkan/vulkan.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct Vertex {
+    glm::vec3 pos;
+    glm::vec3 color;
+    glm::vec3 normal;
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(Vertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(Vertex, pos);
+
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 1;
+        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(Vertex, color);
+
+        attributeDescriptions[2].binding = 0;
+        attributeDescriptions[2].location = 2;
+        attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[2].offset = offsetof(Vertex, normal);
+
+        return attributeDescriptions;
+    }
+};
+
+const uint32_t MAX_LOD_LEVELS = 4;
+
+// A single detail level. Every level indexes into the same vertex buffer,
+// since edge collapses only ever move a vertex onto one of its neighbours.
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
+struct LodChain {
+    std::vector<uint16_t> indices;
+    std::vector<MeshLod> lods;
+    glm::vec3 center;
+    float radius;
+};
+
+// Simplification error allowed at level 1, as a fraction of the mesh's
+// radius. It doubles with every level, as LodSelector halves the screen
+// size each level is drawn at, so the error covers about the same number of
+// pixels whichever level is drawn.
+const float LOD_ERROR_BUDGET = 0.025f;
+
+// Quadric error metric edge collapse. Collapses edges until at most
+// targetIndexCount indices remain, or until the next collapse would exceed
+// maxError, in which case more are left.
+std::vector<uint16_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices, size_t targetIndexCount, float maxError, float *resultError);
+
+// Sphere of radius 0.5, the size of the cube, made by subdividing an
+// icosahedron; each subdivision quadruples its 20 triangles. Unlike the
+// cube, it has detail that LODs can remove.
+void buildSphere(uint32_t subdivisions, std::vector<Vertex>& vertices, std::vector<uint16_t>& indices);
+
+// Largest error a level of a mesh with the given radius may have
+float lodErrorBudget(float radius, uint32_t level);
+
+// Builds successively coarser levels, each about half the triangles of the
+// previous one within its error budget. Stops early once a level fails to
+// shrink the mesh.
+LodChain buildLodChain(const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices, uint32_t maxLevels = MAX_LOD_LEVELS);
+
+// Projected diameter of a bounding sphere in pixels.
+float projectedSize(float radius, float distance, float fovY, float viewportHeight);
+
+// Picks a LOD from projected screen size. A level switch only happens once
+// the size leaves the current band by more than the hysteresis fraction,
+// so objects sitting on a threshold don't pop back and forth every frame.
+// shaders/cull.comp selects the same way.
+class LodSelector {
+    public:
+        LodSelector(float finestSize = 256.0f, float hysteresis = 0.1f) : finestSize(finestSize), hysteresis(hysteresis) {}
+
+        uint32_t select(float screenSize, uint32_t currentLevel, uint32_t levelCount) const;
+
+        // Level i is used down to finestSize / 2^i pixels
+        float threshold(uint32_t level) const;
+        float getHysteresis() const { return hysteresis; }
+
+    private:
+        float finestSize;
+        float hysteresis;
+};
+
+#endif
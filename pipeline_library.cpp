@@ -0,0 +1,168 @@
+#include "pipeline_library.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+PipelineLibrary::~PipelineLibrary() {
+    // Queued tasks hold on to the state; make sure they don't build anything
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->generation++;
+    state->variants.clear();
+}
+
+void PipelineLibrary::createCache(VkDevice device, const std::string& cacheFile) {
+    this->device = device;
+    this->cacheFile = cacheFile;
+
+    // The driver checks the header and ignores data from another device or
+    // driver version, so a stale file only costs a recompile
+    std::ifstream file(cacheFile, std::ios::binary);
+    std::vector<char> data;
+    if (file.is_open())
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    loadedCacheSize = data.size();
+
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create pipeline cache!");
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->cache = cache;
+}
+
+void PipelineLibrary::destroyCache() {
+    if (cache == VK_NULL_HANDLE)
+        return;
+
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, cache, &size, nullptr) == VK_SUCCESS && size > 0) {
+        std::vector<char> data(size);
+        if (vkGetPipelineCacheData(device, cache, &size, data.data()) == VK_SUCCESS) {
+            std::ofstream file(cacheFile, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), size);
+        }
+    }
+
+    vkDestroyPipelineCache(device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->cache = VK_NULL_HANDLE;
+}
+
+void PipelineLibrary::reset(size_t variantCount, BuildFunction build) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->generation++;
+    state->variants.assign(variantCount, Variant());
+    state->build = std::move(build);
+}
+
+void PipelineLibrary::State::buildVariant(std::unique_lock<std::mutex>& lock, uint32_t variant) {
+    variants[variant].state = VARIANT_BUILDING;
+    uint64_t buildGeneration = generation;
+    BuildFunction buildFunction = build;
+    VkPipelineCache buildCache = cache;
+
+    lock.unlock();
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    std::string buildError;
+    try {
+        pipeline = buildFunction(variant, buildCache);
+    } catch (const std::exception& e) {
+        buildError = e.what();
+    }
+    lock.lock();
+
+    // release() waits for running builds, so the generation can't have moved on
+    if (generation == buildGeneration) {
+        variants[variant].state = buildError.empty() ? VARIANT_READY : VARIANT_FAILED;
+        variants[variant].pipeline = pipeline;
+        variants[variant].error = buildError;
+    }
+    built.notify_all();
+}
+
+void PipelineLibrary::queue(ThreadPool& pool, uint32_t variant) {
+    state->variants[variant].state = VARIANT_QUEUED;
+    std::shared_ptr<State> shared = state;
+    uint64_t generation = state->generation;
+    pool.submit([shared, generation, variant]() {
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        if (shared->generation != generation || shared->variants[variant].state != VARIANT_QUEUED)
+            return;
+        shared->buildVariant(lock, variant);
+    });
+}
+
+void PipelineLibrary::precompile(ThreadPool& pool, const std::vector<uint32_t>& variants) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for(uint32_t variant: variants) {
+        if (state->variants[variant].state == VARIANT_EMPTY)
+            queue(pool, variant);
+    }
+}
+
+VkPipeline PipelineLibrary::request(ThreadPool& pool, uint32_t variant) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    Variant& entry = state->variants[variant];
+    switch (entry.state) {
+        case VARIANT_READY:
+            return entry.pipeline;
+        case VARIANT_FAILED:
+            throw std::runtime_error(entry.error);
+        case VARIANT_EMPTY:
+            queue(pool, variant);
+            return VK_NULL_HANDLE;
+        default:
+            return VK_NULL_HANDLE;
+    }
+}
+
+VkPipeline PipelineLibrary::get(uint32_t variant) {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    Variant& entry = state->variants[variant];
+    if (entry.state == VARIANT_EMPTY || entry.state == VARIANT_QUEUED)
+        state->buildVariant(lock, variant);
+    else
+        state->built.wait(lock, [&]() { return entry.state != VARIANT_BUILDING; });
+
+    if (entry.state == VARIANT_FAILED)
+        throw std::runtime_error(entry.error);
+    return entry.pipeline;
+}
+
+void PipelineLibrary::insert(uint32_t variant, VkPipeline pipeline) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    Variant& entry = state->variants[variant];
+    if (entry.state == VARIANT_BUILDING || entry.state == VARIANT_READY)
+        throw std::runtime_error("Pipeline variant is already built!");
+
+    entry.state = VARIANT_READY;
+    entry.pipeline = pipeline;
+}
+
+std::vector<VkPipeline> PipelineLibrary::release() {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->built.wait(lock, [&]() {
+        for(const auto& variant: state->variants) {
+            if (variant.state == VARIANT_BUILDING)
+                return false;
+        }
+        return true;
+    });
+
+    std::vector<VkPipeline> pipelines;
+    for(const auto& variant: state->variants) {
+        if (variant.state == VARIANT_READY)
+            pipelines.push_back(variant.pipeline);
+    }
+
+    state->generation++;
+    state->variants.assign(state->variants.size(), Variant());
+    return pipelines;
+}
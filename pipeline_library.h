@@ -0,0 +1,94 @@
+#ifndef VULKAN_PIPELINE_LIBRARY_H
+#define VULKAN_PIPELINE_LIBRARY_H
+
+#include "vulkan/include/vulkan/vulkan.h"
+#include "thread_pool.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Owns a set of pipeline variants, identified by index, and builds them on
+// the worker pool through one VkPipelineCache. The cache is loaded from and
+// saved to a file, so later runs mostly skip the driver's compiler.
+class PipelineLibrary {
+    public:
+        typedef std::function<VkPipeline(uint32_t variant, VkPipelineCache cache)> BuildFunction;
+
+        ~PipelineLibrary();
+
+        void createCache(VkDevice device, const std::string& cacheFile);
+        // Writes the cache back to its file; release() the pipelines first
+        void destroyCache();
+        VkPipelineCache getCache() const { return cache; }
+        // Bytes read from the cache file, 0 on the first run
+        size_t getLoadedCacheSize() const { return loadedCacheSize; }
+
+        // Starts a new set of variants. build may be called from any thread
+        // and must only rely on state that stays unchanged until release().
+        void reset(size_t variantCount, BuildFunction build);
+
+        // Queues the variants that aren't built or queued yet
+        void precompile(ThreadPool& pool, const std::vector<uint32_t>& variants);
+
+        // Returns the variant if it is built. Otherwise queues it unless
+        // it already is, and returns VK_NULL_HANDLE so the caller can draw
+        // with something else for now. Rethrows the build's error if it failed.
+        VkPipeline request(ThreadPool& pool, uint32_t variant);
+
+        // Returns the variant, building it on the calling thread if no
+        // worker has started on it yet, or waiting for the worker otherwise.
+        // Rethrows the build's error if it failed.
+        VkPipeline get(uint32_t variant);
+
+        // Hands over a pipeline built elsewhere, e.g. to check a shader
+        // before replacing all variants
+        void insert(uint32_t variant, VkPipeline pipeline);
+
+        // Cancels queued builds, waits for running ones and returns every
+        // built pipeline; destroying them is up to the caller
+        std::vector<VkPipeline> release();
+
+    private:
+        enum VariantState {
+            VARIANT_EMPTY,
+            VARIANT_QUEUED,
+            VARIANT_BUILDING,
+            VARIANT_READY,
+            VARIANT_FAILED
+        };
+
+        struct Variant {
+            VariantState state = VARIANT_EMPTY;
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            std::string error;
+        };
+
+        // Shared with queued tasks, which may run after a reset() or after
+        // the library is gone and then have to find out there is nothing to do
+        struct State {
+            std::mutex mutex;
+            std::condition_variable built;
+            uint64_t generation = 0;
+            std::vector<Variant> variants;
+            BuildFunction build;
+            VkPipelineCache cache = VK_NULL_HANDLE;
+
+            void buildVariant(std::unique_lock<std::mutex>& lock, uint32_t variant);
+        };
+
+        // Expects state->mutex to be held
+        void queue(ThreadPool& pool, uint32_t variant);
+
+        std::shared_ptr<State> state = std::make_shared<State>();
+        VkDevice device = VK_NULL_HANDLE;
+        VkPipelineCache cache = VK_NULL_HANDLE;
+        std::string cacheFile;
+        size_t loadedCacheSize = 0;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+NodeHandle SceneGraph::addNode(NodeHandle parent, const glm::mat4& localTransform) {
+    uint32_t parentIndex = NO_PARENT;
+    uint32_t position = static_cast<uint32_t>(size());
+
+    if (parent != INVALID_NODE) {
+        if (parent >= indices.size())
+            throw std::runtime_error("Invalid parent node!");
+
+        // Append at the end of the parent's subtree, and grow every
+        // ancestor's range to cover the new node
+        parentIndex = indices[parent];
+        position = parentIndex + subtreeSizes[parentIndex];
+        for(uint32_t ancestor = parentIndex; ancestor != NO_PARENT; ancestor = parents[ancestor])
+            subtreeSizes[ancestor]++;
+    }
+
+    if (position < size()) {
+        for(auto& index: indices) {
+            if (index >= position)
+                index++;
+        }
+        for(auto& parentOf: parents) {
+            if (parentOf != NO_PARENT && parentOf >= position)
+                parentOf++;
+        }
+    }
+
+    NodeHandle handle = static_cast<NodeHandle>(indices.size());
+    indices.push_back(position);
+
+    parents.insert(parents.begin() + position, parentIndex);
+    subtreeSizes.insert(subtreeSizes.begin() + position, 1);
+    localTransforms.insert(localTransforms.begin() + position, localTransform);
+    worldTransforms.insert(worldTransforms.begin() + position, localTransform);
+    dirty.insert(dirty.begin() + position, 1);
+    handles.insert(handles.begin() + position, handle);
+    dirtyNodes.push_back(handle);
+
+    return handle;
+}
+
+void SceneGraph::setLocalTransform(NodeHandle node, const glm::mat4& localTransform) {
+    uint32_t index = indices[node];
+    localTransforms[index] = localTransform;
+
+    if (!dirty[index]) {
+        dirty[index] = 1;
+        dirtyNodes.push_back(node);
+    }
+}
+
+size_t SceneGraph::update() {
+    updatedNodes.clear();
+    if (dirtyNodes.empty())
+        return 0;
+
+    dirtyIndices.clear();
+    for(NodeHandle node: dirtyNodes)
+        dirtyIndices.push_back(indices[node]);
+    dirtyNodes.clear();
+    std::sort(dirtyIndices.begin(), dirtyIndices.end());
+
+    // Each dirty node's subtree is recomputed front to back. Parents come
+    // first, so a parent's world transform is always final by the time its
+    // children read it. Dirty nodes inside an already covered range are
+    // picked up by that range.
+    uint32_t coveredEnd = 0;
+    for(uint32_t first: dirtyIndices) {
+        if (first < coveredEnd)
+            continue;
+
+        uint32_t end = first + subtreeSizes[first];
+        for(uint32_t i = first; i < end; i++) {
+            uint32_t parent = parents[i];
+            if (parent == NO_PARENT)
+                worldTransforms[i] = localTransforms[i];
+            else
+                worldTransforms[i] = worldTransforms[parent] * localTransforms[i];
+            dirty[i] = 0;
+            updatedNodes.push_back(handles[i]);
+        }
+        coveredEnd = end;
+    }
+
+    return updatedNodes.size();
+}
@@ -0,0 +1,52 @@
+#ifndef VULKAN_SCENE_H
+#define VULKAN_SCENE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Stable reference to a node; indices shift when nodes are inserted
+typedef uint32_t NodeHandle;
+const NodeHandle INVALID_NODE = UINT32_MAX;
+
+// Transform hierarchy stored as parallel arrays in depth-first order, so a
+// parent always precedes its children and every subtree is one contiguous
+// range. update() only walks the ranges below nodes whose local transform
+// changed, so its cost follows what moved rather than the scene size.
+class SceneGraph {
+    public:
+        // Inserting is O(n) since the subtree ranges have to stay
+        // contiguous; the hierarchy is expected to change rarely
+        NodeHandle addNode(NodeHandle parent, const glm::mat4& localTransform = glm::mat4(1.0f));
+
+        void setLocalTransform(NodeHandle node, const glm::mat4& localTransform);
+        const glm::mat4& getLocalTransform(NodeHandle node) const { return localTransforms[indices[node]]; }
+        const glm::mat4& getWorldTransform(NodeHandle node) const { return worldTransforms[indices[node]]; }
+
+        // Recomputes the world transforms of dirty subtrees and returns how
+        // many nodes were touched
+        size_t update();
+
+        // Nodes whose world transform was recomputed by the last update()
+        const std::vector<NodeHandle>& getUpdatedNodes() const { return updatedNodes; }
+
+        size_t size() const { return parents.size(); }
+
+    private:
+        static const uint32_t NO_PARENT = UINT32_MAX;
+
+        std::vector<uint32_t> parents;
+        std::vector<uint32_t> subtreeSizes;
+        std::vector<glm::mat4> localTransforms;
+        std::vector<glm::mat4> worldTransforms;
+        std::vector<uint8_t> dirty;
+        std::vector<NodeHandle> handles;
+
+        std::vector<uint32_t> indices;
+        std::vector<NodeHandle> dirtyNodes;
+        std::vector<uint32_t> dirtyIndices;
+        std::vector<NodeHandle> updatedNodes;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "shader_modules.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+static size_t hashCode(SpirvCode code) {
+    size_t hash = code.wordCount;
+    for(size_t i = 0; i < code.wordCount; i++)
+        hash ^= std::hash<uint32_t>()(code.words[i]) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+VkShaderModule ShaderModuleCache::get(VkDevice device, SpirvCode code) {
+    size_t hash = hashCode(code);
+
+    auto range = modules.equal_range(hash);
+    for(auto entry = range.first; entry != range.second; ++entry) {
+        const auto& cached = entry->second.code;
+        if (std::equal(cached.begin(), cached.end(), code.words, code.words + code.wordCount))
+            return entry->second.module;
+    }
+
+    VkShaderModuleCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = code.size();
+    createInfo.pCode = code.words;
+
+    VkShaderModule module;
+    if (vkCreateShaderModule(device, &createInfo, nullptr, &module) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create Shader Module!");
+
+    modules.insert({hash, {std::vector<uint32_t>(code.words, code.words + code.wordCount), module}});
+    return module;
+}
+
+void ShaderModuleCache::destroy(VkDevice device) {
+    for(auto& entry: modules)
+        vkDestroyShaderModule(device, entry.second.module, nullptr);
+    modules.clear();
+}
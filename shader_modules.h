@@ -0,0 +1,28 @@
+#ifndef VULKAN_SHADER_MODULES_H
+#define VULKAN_SHADER_MODULES_H
+
+#include "vulkan/include/vulkan/vulkan.h"
+#include "spirv.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Creates one VkShaderModule per distinct SPIR-V code and keeps it until
+// the device is destroyed, so rebuilding pipelines doesn't recreate them
+class ShaderModuleCache {
+    public:
+        VkShaderModule get(VkDevice device, SpirvCode code);
+        void destroy(VkDevice device);
+
+        size_t size() const { return modules.size(); }
+
+    private:
+        struct Entry {
+            std::vector<uint32_t> code;
+            VkShaderModule module;
+        };
+
+        std::unordered_multimap<size_t, Entry> modules;
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include "shader_reflection.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+#include "vulkan/include/spirv_cross/spirv_cross.hpp"
+
+static bool sameBindings(const std::vector<VkDescriptorSetLayoutBinding>& a, const std::vector<VkDescriptorSetLayoutBinding>& b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const VkDescriptorSetLayoutBinding& x, const VkDescriptorSetLayoutBinding& y) {
+        return x.binding == y.binding && x.descriptorType == y.descriptorType && x.descriptorCount == y.descriptorCount && x.stageFlags == y.stageFlags;
+    });
+}
+
+void ShaderLayout::addStage(SpirvCode spirv, VkShaderStageFlagBits stage) {
+    spirv_cross::Compiler compiler(spirv.words, spirv.wordCount);
+    auto resources = compiler.get_shader_resources(compiler.get_active_interface_variables());
+
+    auto addResource = [&](const spirv_cross::Resource& resource, VkDescriptorType type) {
+        const auto& spirType = compiler.get_type(resource.type_id);
+        uint32_t set = compiler.get_decoration(resource.id, spv::DecorationDescriptorSet);
+
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = compiler.get_decoration(resource.id, spv::DecorationBinding);
+        binding.descriptorType = type;
+        binding.descriptorCount = spirType.array.empty() ? 1 : spirType.array[0];
+        binding.stageFlags = stage;
+        addBinding(set, binding);
+
+        if (type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+            VkDeviceSize size = compiler.get_declared_struct_size(compiler.get_type(resource.base_type_id));
+            auto& known = uniformSizes[{set, binding.binding}];
+            if (known != 0 && known != size)
+                throw std::runtime_error("Shader stages disagree on the size of a uniform block!");
+            known = size;
+        }
+    };
+
+    for(const auto& resource: resources.uniform_buffers)
+        addResource(resource, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    for(const auto& resource: resources.storage_buffers)
+        addResource(resource, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    for(const auto& resource: resources.sampled_images)
+        addResource(resource, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    for(const auto& resource: resources.separate_samplers)
+        addResource(resource, VK_DESCRIPTOR_TYPE_SAMPLER);
+    for(const auto& resource: resources.subpass_inputs)
+        addResource(resource, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT);
+
+    // Buffer dimensioned images are texel buffers
+    for(const auto& resource: resources.separate_images) {
+        bool texelBuffer = compiler.get_type(resource.type_id).image.dim == spv::DimBuffer;
+        addResource(resource, texelBuffer ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
+    }
+    for(const auto& resource: resources.storage_images) {
+        bool texelBuffer = compiler.get_type(resource.type_id).image.dim == spv::DimBuffer;
+        addResource(resource, texelBuffer ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    }
+
+    for(const auto& resource: resources.push_constant_buffers) {
+        uint32_t size = static_cast<uint32_t>(compiler.get_declared_struct_size(compiler.get_type(resource.base_type_id)));
+
+        auto range = std::find_if(pushConstantRanges.begin(), pushConstantRanges.end(), [&](const VkPushConstantRange& r) {
+            return r.stageFlags == static_cast<VkShaderStageFlags>(stage);
+        });
+        if (range == pushConstantRanges.end())
+            pushConstantRanges.push_back({static_cast<VkShaderStageFlags>(stage), 0, size});
+        else
+            range->size = std::max(range->size, size);
+    }
+}
+
+void ShaderLayout::addBinding(uint32_t set, const VkDescriptorSetLayoutBinding& binding) {
+    if (set >= sets.size())
+        sets.resize(set + 1);
+
+    auto& bindings = sets[set];
+    auto existing = std::lower_bound(bindings.begin(), bindings.end(), binding.binding, [](const VkDescriptorSetLayoutBinding& b, uint32_t index) {
+        return b.binding < index;
+    });
+
+    if (existing == bindings.end() || existing->binding != binding.binding) {
+        bindings.insert(existing, binding);
+        return;
+    }
+
+    if (existing->descriptorType != binding.descriptorType || existing->descriptorCount != binding.descriptorCount)
+        throw std::runtime_error("Shader stages declare conflicting descriptor bindings!");
+    existing->stageFlags |= binding.stageFlags;
+}
+
+void ShaderLayout::setDynamic(uint32_t set, uint32_t binding) {
+    if (set >= sets.size())
+        return;
+
+    for(auto& b: sets[set]) {
+        if (b.binding != binding)
+            continue;
+
+        if (b.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+            b.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        else if (b.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+            b.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        else
+            throw std::runtime_error("Only buffers can be bound with dynamic offsets!");
+    }
+}
+
+uint32_t ShaderLayout::getDynamicOffsetCount() const {
+    uint32_t count = 0;
+    for(const auto& bindings: sets) {
+        for(const auto& binding: bindings) {
+            if (binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC)
+                count += binding.descriptorCount;
+        }
+    }
+    return count;
+}
+
+const VkDescriptorSetLayoutBinding *ShaderLayout::findBinding(uint32_t set, uint32_t binding) const {
+    if (set >= sets.size())
+        return nullptr;
+
+    for(const auto& b: sets[set]) {
+        if (b.binding == binding)
+            return &b;
+    }
+    return nullptr;
+}
+
+VkDeviceSize ShaderLayout::getUniformSize(uint32_t set, uint32_t binding) const {
+    auto size = uniformSizes.find({set, binding});
+    return size == uniformSizes.end() ? 0 : size->second;
+}
+
+bool ShaderLayout::sameInterface(const ShaderLayout& other) const {
+    bool sameSets = std::equal(sets.begin(), sets.end(), other.sets.begin(), other.sets.end(), sameBindings);
+    bool samePushConstants = std::equal(pushConstantRanges.begin(), pushConstantRanges.end(), other.pushConstantRanges.begin(), other.pushConstantRanges.end(), [](const VkPushConstantRange& x, const VkPushConstantRange& y) {
+        return x.stageFlags == y.stageFlags && x.offset == y.offset && x.size == y.size;
+    });
+    return sameSets && samePushConstants && uniformSizes == other.uniformSizes;
+}
+
+void ShaderLayout::addPoolSizes(uint32_t set, uint32_t setCount, std::vector<VkDescriptorPoolSize>& poolSizes) const {
+    if (set >= sets.size())
+        return;
+
+    for(const auto& binding: sets[set]) {
+        auto poolSize = std::find_if(poolSizes.begin(), poolSizes.end(), [&](const VkDescriptorPoolSize& p) {
+            return p.type == binding.descriptorType;
+        });
+        if (poolSize == poolSizes.end())
+            poolSizes.push_back({binding.descriptorType, binding.descriptorCount * setCount});
+        else
+            poolSize->descriptorCount += binding.descriptorCount * setCount;
+    }
+}
+
+VkDescriptorUpdateTemplate ShaderLayout::createUpdateTemplate(VkDevice device, uint32_t set, VkDescriptorSetLayout layout) const {
+    if (set >= sets.size() || sets[set].empty())
+        return VK_NULL_HANDLE;
+
+    std::vector<VkDescriptorUpdateTemplateEntry> entries;
+    for(const auto& binding: sets[set]) {
+        // Each binding has a single DescriptorInfo
+        if (binding.descriptorCount != 1)
+            throw std::runtime_error("Update templates don't support descriptor arrays!");
+
+        VkDescriptorUpdateTemplateEntry entry = {};
+        entry.dstBinding = binding.binding;
+        entry.descriptorCount = 1;
+        entry.descriptorType = binding.descriptorType;
+        entry.offset = binding.binding * sizeof(DescriptorInfo);
+        entry.stride = sizeof(DescriptorInfo);
+        entries.push_back(entry);
+    }
+
+    VkDescriptorUpdateTemplateCreateInfo templateInfo = {};
+    templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+    templateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size());
+    templateInfo.pDescriptorUpdateEntries = entries.data();
+    templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+    templateInfo.descriptorSetLayout = layout;
+
+    VkDescriptorUpdateTemplate updateTemplate;
+    if (vkCreateDescriptorUpdateTemplate(device, &templateInfo, nullptr, &updateTemplate) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create descriptor update template!");
+    return updateTemplate;
+}
+
+void ShaderLayout::updateDescriptorSet(VkDevice device, uint32_t set, VkDescriptorUpdateTemplate updateTemplate, VkDescriptorSet descriptorSet, const std::vector<DescriptorInfo>& infos) const {
+    if (updateTemplate == VK_NULL_HANDLE)
+        return;
+
+    // Bindings are sorted, so the last one is the highest
+    if (sets[set].back().binding >= infos.size())
+        throw std::runtime_error("Missing descriptor for a binding the shaders use!");
+
+    vkUpdateDescriptorSetWithTemplate(device, descriptorSet, updateTemplate, infos.data());
+}
+
+static size_t hashBindings(const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+    size_t hash = bindings.size();
+    for(const auto& binding: bindings) {
+        for(uint32_t value: {binding.binding, static_cast<uint32_t>(binding.descriptorType), binding.descriptorCount, binding.stageFlags})
+            hash ^= std::hash<uint32_t>()(value) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
+VkDescriptorSetLayout DescriptorSetLayoutCache::get(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+    size_t hash = hashBindings(bindings);
+
+    auto range = layouts.equal_range(hash);
+    for(auto entry = range.first; entry != range.second; ++entry) {
+        if (sameBindings(entry->second.bindings, bindings))
+            return entry->second.layout;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    VkDescriptorSetLayout layout;
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create a Descriptor Set Layout!");
+
+    layouts.insert({hash, {bindings, layout}});
+    return layout;
+}
+
+void DescriptorSetLayoutCache::destroy(VkDevice device) {
+    for(auto& entry: layouts)
+        vkDestroyDescriptorSetLayout(device, entry.second.layout, nullptr);
+    layouts.clear();
+}
@@ -0,0 +1,92 @@
+#ifndef VULKAN_SHADER_REFLECTION_H
+#define VULKAN_SHADER_REFLECTION_H
+
+#include "vulkan/include/vulkan/vulkan.h"
+#include "spirv.h"
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// What an update template writes to one binding. The data for a set is an
+// array of these indexed by binding number.
+union DescriptorInfo {
+    VkDescriptorBufferInfo buffer;
+    VkDescriptorImageInfo image;
+
+    DescriptorInfo() : buffer() {}
+    DescriptorInfo(VkBuffer b, VkDeviceSize offset, VkDeviceSize range) : buffer({b, offset, range}) {}
+    DescriptorInfo(VkSampler sampler, VkImageView view, VkImageLayout layout) : image({sampler, view, layout}) {}
+};
+
+// Descriptor bindings, push constants and uniform block sizes that a group
+// of shader stages use, read back from their SPIR-V. Only resources the
+// shaders actually access are included.
+class ShaderLayout {
+    public:
+        // Reflects one stage and merges it in; a binding used by several
+        // stages gets all of their stage flags
+        void addStage(SpirvCode spirv, VkShaderStageFlagBits stage);
+
+        // Indexed by set number, sorted by binding. Sets that no stage uses
+        // in between are left empty. Runtime sized arrays have a
+        // descriptorCount of 0.
+        const std::vector<std::vector<VkDescriptorSetLayoutBinding>>& getSets() const { return sets; }
+        const std::vector<VkPushConstantRange>& getPushConstantRanges() const { return pushConstantRanges; }
+
+        // SPIR-V can't tell dynamic buffers apart, so the app marks the ones
+        // it binds with dynamic offsets before creating the set layouts
+        void setDynamic(uint32_t set, uint32_t binding);
+
+        // Number of dynamic offsets binding all sets takes
+        uint32_t getDynamicOffsetCount() const;
+
+        const VkDescriptorSetLayoutBinding *findBinding(uint32_t set, uint32_t binding) const;
+        // Declared size of a uniform block, or 0 if no stage uses it
+        VkDeviceSize getUniformSize(uint32_t set, uint32_t binding) const;
+
+        // Whether other has the same bindings, push constant ranges and
+        // uniform block sizes, so its shaders fit layouts made from this one
+        bool sameInterface(const ShaderLayout& other) const;
+
+        // Adds what setCount copies of a set need to a descriptor pool
+        void addPoolSizes(uint32_t set, uint32_t setCount, std::vector<VkDescriptorPoolSize>& poolSizes) const;
+
+        // Creates a template that writes every binding of the set the
+        // shaders use from an array of DescriptorInfo, skipping the entries
+        // of bindings they don't use. Returns VK_NULL_HANDLE if they use none.
+        VkDescriptorUpdateTemplate createUpdateTemplate(VkDevice device, uint32_t set, VkDescriptorSetLayout layout) const;
+
+        // Updates the set in one call; infos must have an entry for every
+        // binding the template writes
+        void updateDescriptorSet(VkDevice device, uint32_t set, VkDescriptorUpdateTemplate updateTemplate, VkDescriptorSet descriptorSet, const std::vector<DescriptorInfo>& infos) const;
+
+    private:
+        void addBinding(uint32_t set, const VkDescriptorSetLayoutBinding& binding);
+
+        std::vector<std::vector<VkDescriptorSetLayoutBinding>> sets;
+        std::vector<VkPushConstantRange> pushConstantRanges;
+        std::map<std::pair<uint32_t, uint32_t>, VkDeviceSize> uniformSizes;
+};
+
+// Shares one VkDescriptorSetLayout between every request with the same
+// bindings
+class DescriptorSetLayoutCache {
+    public:
+        VkDescriptorSetLayout get(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+        void destroy(VkDevice device);
+
+        size_t size() const { return layouts.size(); }
+
+    private:
+        struct Entry {
+            std::vector<VkDescriptorSetLayoutBinding> bindings;
+            VkDescriptorSetLayout layout;
+        };
+
+        std::unordered_multimap<size_t, Entry> layouts;
+};
+
+#endif
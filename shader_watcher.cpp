@@ -0,0 +1,154 @@
+#include "shader_watcher.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <shaderc/shaderc.hpp>
+
+static bool shaderKindFromName(const std::string& name, shaderc_shader_kind *kind) {
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+
+    std::string extension = name.substr(dot + 1);
+    if (extension == "vert")
+        *kind = shaderc_vertex_shader;
+    else if (extension == "frag")
+        *kind = shaderc_fragment_shader;
+    else if (extension == "comp")
+        *kind = shaderc_compute_shader;
+    else
+        return false;
+
+    return true;
+}
+
+ShaderWatcher::ShaderWatcher(const std::string& directory, std::function<void()> onCompiled) : directory(directory), onCompiled(onCompiled) {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+        throw std::runtime_error("Failed to initialize inotify!");
+
+    // Editors either rewrite the file in place or rename a temporary over it
+    if (inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(inotifyFd);
+        throw std::runtime_error("Failed to watch the shader directory!");
+    }
+
+    stopFd = eventfd(0, EFD_CLOEXEC);
+    if (stopFd < 0) {
+        close(inotifyFd);
+        throw std::runtime_error("Failed to create the shader watcher's eventfd!");
+    }
+
+    thread = std::thread(&ShaderWatcher::watchLoop, this);
+}
+
+ShaderWatcher::~ShaderWatcher() {
+    uint64_t stop = 1;
+    if (write(stopFd, &stop, sizeof(stop)) != sizeof(stop))
+        std::cerr << "Failed to stop the shader watcher: " << strerror(errno) << "\n";
+    thread.join();
+
+    close(stopFd);
+    close(inotifyFd);
+}
+
+std::vector<CompiledShader> ShaderWatcher::takeCompiled() {
+    std::lock_guard<std::mutex> lock(compiledMutex);
+    std::vector<CompiledShader> shaders;
+    shaders.swap(compiled);
+    return shaders;
+}
+
+bool ShaderWatcher::hasCompiled() {
+    std::lock_guard<std::mutex> lock(compiledMutex);
+    return !compiled.empty();
+}
+
+void ShaderWatcher::watchLoop() {
+    pollfd fds[2] = {
+        {inotifyFd, POLLIN, 0},
+        {stopFd, POLLIN, 0}
+    };
+    std::set<std::string> changed;
+    alignas(inotify_event) char buffer[4096];
+
+    while(true) {
+        int ready = poll(fds, 2, changed.empty() ? -1 : SHADER_RELOAD_DELAY_MS);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Shader watcher stopped: " << strerror(errno) << "\n";
+            return;
+        }
+
+        if (fds[1].revents & POLLIN)
+            return;
+
+        if (ready == 0) {
+            for(const auto& name: changed) {
+                CompiledShader shader;
+                if (compile(directory + "/" + name, shader)) {
+                    {
+                        std::lock_guard<std::mutex> lock(compiledMutex);
+                        compiled.push_back(std::move(shader));
+                    }
+                    if (onCompiled)
+                        onCompiled();
+                }
+            }
+            changed.clear();
+            continue;
+        }
+
+        ssize_t length;
+        while((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for(char *p = buffer; p < buffer + length; ) {
+                auto event = reinterpret_cast<const inotify_event *>(p);
+                shaderc_shader_kind kind;
+                if (event->len > 0 && shaderKindFromName(event->name, &kind))
+                    changed.insert(event->name);
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+}
+
+bool ShaderWatcher::compile(const std::string& source, CompiledShader& shader) {
+    shaderc_shader_kind kind;
+    if (!shaderKindFromName(source, &kind))
+        return false;
+
+    std::ifstream file(source);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open " << source << "\n";
+        return false;
+    }
+    std::stringstream glsl;
+    glsl << file.rdbuf();
+
+    shaderc::Compiler compiler;
+    shaderc::CompileOptions options;
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+    options.SetOptimizationLevel(shaderc_optimization_level_performance);
+
+    auto result = compiler.CompileGlslToSpv(glsl.str(), kind, source.c_str(), options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+        std::cerr << result.GetErrorMessage();
+        return false;
+    }
+
+    shader.source = source;
+    shader.spirv.assign(result.cbegin(), result.cend());
+    return true;
+}
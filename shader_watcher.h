@@ -0,0 +1,48 @@
+#ifndef VULKAN_SHADER_WATCHER_H
+#define VULKAN_SHADER_WATCHER_H
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CompiledShader {
+    std::string source;     // Path of the GLSL file, e.g. "shaders/shader.vert"
+    std::vector<uint32_t> spirv;
+};
+
+// Editors often save a file in several writes, so a change is only compiled
+// once the directory has been quiet for this long
+const int SHADER_RELOAD_DELAY_MS = 100;
+
+// Watches a directory with inotify and recompiles the GLSL files that change
+// there on a background thread with shaderc. Files that fail to compile are
+// reported and dropped, so whatever was last compiled stays in use.
+class ShaderWatcher {
+    public:
+        // onCompiled is called on the watcher's thread after each shader
+        // that compiled, e.g. to wake up a thread waiting for events
+        ShaderWatcher(const std::string& directory, std::function<void()> onCompiled = nullptr);
+        ~ShaderWatcher();
+
+        // Shaders compiled since the last call, oldest first
+        std::vector<CompiledShader> takeCompiled();
+        bool hasCompiled();
+
+    private:
+        void watchLoop();
+        bool compile(const std::string& source, CompiledShader& shader);
+
+        std::string directory;
+        std::function<void()> onCompiled;
+        int inotifyFd = -1;
+        int stopFd = -1;
+        std::thread thread;
+
+        std::mutex compiledMutex;
+        std::vector<CompiledShader> compiled;
+};
+
+#endif
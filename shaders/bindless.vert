@@ -0,0 +1,47 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+// Vertex shader for --bindless. Its buffers aren't bound one by one; they
+// are looked up in the array of every buffer the app registered.
+
+struct ObjectData {
+    mat4 model;
+    vec4 boundingSphere;
+    uint program;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer TransformBuffer {
+    mat4 view;
+    mat4 proj;
+} transformBuffers[];
+
+layout(std430, set = 0, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffers[];
+
+// Indices into the buffer array, pushed once per frame
+layout(push_constant) uniform BufferIndices {
+    uint transforms;
+    uint objects;
+} indices;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec3 inNormal;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 outNormal;
+layout(location = 2) out vec3 outViewPosition;
+layout(location = 3) out vec3 outViewNormal;
+
+void main() {
+    mat4 model = objectBuffers[indices.objects].objects[gl_InstanceIndex].model;
+    mat4 modelView = transformBuffers[indices.transforms].view * model;
+    vec4 viewPosition = modelView * vec4(inPosition, 1.0);
+    gl_Position = transformBuffers[indices.transforms].proj * viewPosition;
+    fragColor = inColor;
+    outNormal = inNormal;
+    outViewPosition = viewPosition.xyz;
+    outViewNormal = (modelView * vec4(inNormal, 0.0)).xyz;
+}
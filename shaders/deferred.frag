@@ -0,0 +1,115 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The lighting subpass of --deferred. Every pixel is shaded once from the
+// G-buffer that uber.frag wrote, however many fragments were drawn to it.
+// Must light like the LIGHTING_COOL variants of uber.frag.
+
+// Must match MAX_LIGHTS in app.h
+#define MAX_LIGHTS 3
+
+// Must match light_clusters.h
+const uint CLUSTER_COUNT_X = 16;
+const uint CLUSTER_COUNT_Y = 9;
+const uint CLUSTER_COUNT_Z = 24;
+
+const uint LIGHTING_COOL = 1;
+
+// Written by the geometry subpass at this very pixel
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput gBufferColor;
+layout(input_attachment_index = 1, set = 0, binding = 1) uniform subpassInput gBufferNormals;
+layout(input_attachment_index = 2, set = 0, binding = 2) uniform subpassInput gBufferDepth;
+
+// The graphics pipelines' light set, bound as is; must match uber.frag
+layout(set = 1, binding = 0) uniform UniformBufferObject {
+    vec4 lightDirs[MAX_LIGHTS];
+    vec3 lightColor;
+    float clusterSliceScale;
+    vec2 clusterTileScale;
+    float clusterSliceBias;
+} lo;
+
+struct PointLight {
+    vec3 position;
+    float range;
+    vec3 color;
+    float spotOuterCos;
+    vec3 direction;
+    float spotInnerCos;
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer PointLights {
+    PointLight pointLights[];
+};
+
+layout(std430, set = 1, binding = 2) readonly buffer LightClusters {
+    uvec2 clusters[];
+};
+
+layout(std430, set = 1, binding = 3) readonly buffer LightIndices {
+    uint lightIndices[];
+};
+
+layout(push_constant) uniform LightingConstants {
+    // 1 / proj[0][0], 1 / proj[1][1], proj[2][2] and proj[3][2], which
+    // turn a depth back into a view space position
+    vec4 unproject;
+    vec2 pixelToNdc;
+    uint lightCount;
+} lc;
+
+layout(location = 0) out vec4 outColor;
+
+// Inverse of octEncode() in uber.frag
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+vec3 clusteredLight(vec3 viewPosition, vec3 normal) {
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * lo.clusterTileScale), uvec2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+    float slice = floor(log(-viewPosition.z) * lo.clusterSliceScale + lo.clusterSliceBias);
+    uint z = uint(clamp(slice, 0.0, float(CLUSTER_COUNT_Z - 1)));
+    uvec2 cluster = clusters[(z * CLUSTER_COUNT_Y + tile.y) * CLUSTER_COUNT_X + tile.x];
+
+    vec3 light = vec3(0.0);
+    for (uint i = 0; i < cluster.y; i++) {
+        PointLight pointLight = pointLights[lightIndices[cluster.x + i]];
+        vec3 toLight = pointLight.position - viewPosition;
+        float distance = length(toLight);
+        vec3 direction = toLight / distance;
+
+        float falloff = clamp(1.0 - distance / pointLight.range, 0.0, 1.0);
+        float cone = smoothstep(pointLight.spotOuterCos, pointLight.spotInnerCos, dot(-direction, pointLight.direction));
+        light += pointLight.color * (falloff * falloff * cone * max(dot(normal, direction), 0.0));
+    }
+    return light;
+}
+
+void main() {
+    // Unlit programs and the background, which is cleared to black
+    vec4 color = subpassLoad(gBufferColor);
+    if (uint(color.a + 0.5) != LIGHTING_COOL) {
+        outColor = vec4(color.rgb, 1.0);
+        return;
+    }
+
+    vec4 normals = subpassLoad(gBufferNormals);
+    vec3 normal = octDecode(normals.xy);
+    vec3 viewNormal = octDecode(normals.zw);
+
+    float viewZ = -lc.unproject.w / (subpassLoad(gBufferDepth).x + lc.unproject.z);
+    vec2 ndc = gl_FragCoord.xy * lc.pixelToNdc - 1.0;
+    vec3 viewPosition = vec3(ndc * lc.unproject.xy * -viewZ, viewZ);
+
+    vec3 coolColor = vec3(0.0, 0.0, 0.55) + color.rgb;
+    vec3 unlitColor = 0.8 * coolColor;
+
+    float lit = 1.0;
+    for (uint i = 0; i < lc.lightCount; i++)
+        lit += dot(normalize(lo.lightDirs[i].xyz), normal);
+
+    outColor = vec4(unlitColor * lit + coolColor * clusteredLight(viewPosition, viewNormal), 1.0);
+}
@@ -1,22 +1,59 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(set = 0, binding = 0) uniform UniformBufferObject {
+// Where each draw's model matrix comes from, see ObjectDataSource in app.h
+const uint OBJECT_DATA_INSTANCE = 0;
+const uint OBJECT_DATA_PUSH = 1;
+const uint OBJECT_DATA_DYNAMIC = 2;
+
+layout(constant_id = 0) const uint OBJECT_DATA = OBJECT_DATA_INSTANCE;
+
+struct ObjectData {
     mat4 model;
+    vec4 boundingSphere;
+    uint program;
+};
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
     mat4 view;
     mat4 proj;
 } ubo;
 
+layout(std430, set = 0, binding = 1) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+};
+
+layout(push_constant) uniform DrawConstants {
+    mat4 model;
+} drawConstants;
+
+layout(set = 2, binding = 0) uniform DrawUniforms {
+    mat4 model;
+} drawUniforms;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec3 inNormal;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec3 outNormal;
+// For the clustered point lights
+layout(location = 2) out vec3 outViewPosition;
+layout(location = 3) out vec3 outViewNormal;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    mat4 model;
+    if (OBJECT_DATA == OBJECT_DATA_PUSH)
+        model = drawConstants.model;
+    else if (OBJECT_DATA == OBJECT_DATA_DYNAMIC)
+        model = drawUniforms.model;
+    else
+        model = objects[gl_InstanceIndex].model;
+
+    vec4 viewPosition = ubo.view * model * vec4(inPosition, 1.0);
+    gl_Position = ubo.proj * viewPosition;
     fragColor = inColor;
     outNormal = inNormal;
+    outViewPosition = viewPosition.xyz;
+    outViewNormal = (ubo.view * model * vec4(inNormal, 0.0)).xyz;
 }
-
@@ -0,0 +1,121 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Must match MAX_LIGHTS in app.h
+#define MAX_LIGHTS 3
+
+// Must match light_clusters.h
+const uint CLUSTER_COUNT_X = 16;
+const uint CLUSTER_COUNT_Y = 9;
+const uint CLUSTER_COUNT_Z = 24;
+
+const uint LIGHTING_UNLIT = 0;
+const uint LIGHTING_COOL = 1;
+
+// Set per pipeline through VkSpecializationInfo, so each variant only
+// keeps the lighting it uses
+layout(constant_id = 0) const uint LIGHTING_MODEL = LIGHTING_UNLIT;
+layout(constant_id = 1) const uint LIGHT_COUNT = MAX_LIGHTS;
+// With --deferred, the fragment is written to the G-buffer instead, and
+// shaders/deferred.frag lights it
+layout(constant_id = 2) const bool G_BUFFER = false;
+
+layout(set = 1, binding = 0) uniform UniformBufferObject {
+    vec4 lightDirs[MAX_LIGHTS];
+    vec3 lightColor;
+    // Map gl_FragCoord and view space depth to a cluster
+    float clusterSliceScale;
+    vec2 clusterTileScale;
+    float clusterSliceBias;
+} lo;
+
+// Point and spot lights in view space
+struct PointLight {
+    vec3 position;
+    float range;
+    vec3 color;
+    float spotOuterCos;
+    vec3 direction;
+    float spotInnerCos;
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer PointLights {
+    PointLight pointLights[];
+};
+
+// Offset and count of each cluster's lights in lightIndices
+layout(std430, set = 1, binding = 2) readonly buffer LightClusters {
+    uvec2 clusters[];
+};
+
+layout(std430, set = 1, binding = 3) readonly buffer LightIndices {
+    uint lightIndices[];
+};
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec3 inViewPosition;
+layout(location = 3) in vec3 inViewNormal;
+
+// Only the lights that reach the fragment's cluster are looked at
+vec3 clusteredLight() {
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * lo.clusterTileScale), uvec2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+    float slice = floor(log(-inViewPosition.z) * lo.clusterSliceScale + lo.clusterSliceBias);
+    uint z = uint(clamp(slice, 0.0, float(CLUSTER_COUNT_Z - 1)));
+    uvec2 cluster = clusters[(z * CLUSTER_COUNT_Y + tile.y) * CLUSTER_COUNT_X + tile.x];
+
+    vec3 normal = normalize(inViewNormal);
+    vec3 light = vec3(0.0);
+    for (uint i = 0; i < cluster.y; i++) {
+        PointLight pointLight = pointLights[lightIndices[cluster.x + i]];
+        vec3 toLight = pointLight.position - inViewPosition;
+        float distance = length(toLight);
+        vec3 direction = toLight / distance;
+
+        float falloff = clamp(1.0 - distance / pointLight.range, 0.0, 1.0);
+        float cone = smoothstep(pointLight.spotOuterCos, pointLight.spotInnerCos, dot(-direction, pointLight.direction));
+        light += pointLight.color * (falloff * falloff * cone * max(dot(normal, direction), 0.0));
+    }
+    return light;
+}
+
+layout(location = 0) out vec4 outColor;
+// The G-buffer's normals; outColor then holds the lighting model in alpha.
+// Only writeGBuffer() touches it, and only when G_BUFFER is set: the forward
+// subpass has no attachment at location 1.
+layout(location = 1) out vec4 outNormals;
+
+// Maps a unit vector onto the octahedron, unfolded into [-1, 1]^2
+vec2 octEncode(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0)
+        return (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.xy;
+}
+
+void writeGBuffer() {
+    outColor = vec4(fragColor, float(LIGHTING_MODEL));
+    outNormals = vec4(octEncode(normalize(inNormal)), octEncode(normalize(inViewNormal)));
+}
+
+void main() {
+    if (G_BUFFER) {
+        writeGBuffer();
+        return;
+    }
+
+    if (LIGHTING_MODEL == LIGHTING_UNLIT) {
+        outColor = vec4(fragColor, 1.0);
+        return;
+    }
+
+    vec3 coolColor = vec3(0.0, 0.0, 0.55) + fragColor;
+    vec3 unlitColor = 0.8 * coolColor;
+    vec3 normal = normalize(inNormal);
+
+    float lit = 1.0;
+    for (uint i = 0; i < LIGHT_COUNT; i++)
+        lit += dot(normalize(lo.lightDirs[i].xyz), normal);
+
+    outColor = vec4(unlitColor * lit + coolColor * clusteredLight(), 1.0);
+}
@@ -0,0 +1,194 @@
+#ifndef VULKAN_SPIRV_H
+#define VULKAN_SPIRV_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Non-owning view of SPIR-V code. The words are either embedded in the
+// binary or owned by a vector that has to outlive the view.
+struct SpirvCode {
+    const uint32_t *words = nullptr;
+    size_t wordCount = 0;
+
+    SpirvCode() = default;
+    constexpr SpirvCode(const uint32_t *words, size_t wordCount) : words(words), wordCount(wordCount) {}
+    SpirvCode(const std::vector<uint32_t>& code) : words(code.data()), wordCount(code.size()) {}
+
+    size_t size() const { return wordCount * sizeof(uint32_t); }
+};
+
+// View of SPIR-V code embedded as an array, usable in constant expressions
+template<size_t N>
+constexpr SpirvCode spirvCode(const uint32_t (&words)[N]) {
+    return SpirvCode(words, N);
+}
+
+// A compiled shader that the build turned into an array, see embed_spirv.sh
+struct EmbeddedShader {
+    const char *file;
+    const uint32_t *words;
+    size_t wordCount;
+};
+
+// The functions below read the layout of a shader's blocks straight from its
+// code. They're constexpr, so the layouts of embedded shaders can be checked
+// with static_assert; ShaderLayout reflects everything else at runtime.
+
+const size_t SPIRV_HEADER_WORDS = 5;
+
+enum SpirvOp : uint32_t {
+    SPIRV_OP_TYPE_INT = 21,
+    SPIRV_OP_TYPE_FLOAT = 22,
+    SPIRV_OP_TYPE_VECTOR = 23,
+    SPIRV_OP_TYPE_MATRIX = 24,
+    SPIRV_OP_TYPE_ARRAY = 28,
+    SPIRV_OP_TYPE_RUNTIME_ARRAY = 29,
+    SPIRV_OP_TYPE_STRUCT = 30,
+    SPIRV_OP_TYPE_POINTER = 32,
+    SPIRV_OP_CONSTANT = 43,
+    SPIRV_OP_VARIABLE = 59,
+    SPIRV_OP_DECORATE = 71,
+    SPIRV_OP_MEMBER_DECORATE = 72
+};
+
+enum SpirvDecoration : uint32_t {
+    SPIRV_DECORATION_ARRAY_STRIDE = 6,
+    SPIRV_DECORATION_BINDING = 33,
+    SPIRV_DECORATION_DESCRIPTOR_SET = 34,
+    SPIRV_DECORATION_OFFSET = 35
+};
+
+// Index of the first instruction with the opcode whose operand word at index
+// holds the value, or 0 if there is none
+constexpr size_t spirvFind(SpirvCode code, uint32_t opcode, size_t index, uint32_t value) {
+    for(size_t i = SPIRV_HEADER_WORDS; i < code.wordCount;) {
+        uint32_t length = code.words[i] >> 16;
+        if (length == 0)
+            return 0;
+        if ((code.words[i] & 0xffff) == opcode && index < length && code.words[i + index] == value)
+            return i;
+        i += length;
+    }
+    return 0;
+}
+
+// Index of the instruction that declares a type
+constexpr size_t spirvFindType(SpirvCode code, uint32_t type) {
+    for(uint32_t opcode: {SPIRV_OP_TYPE_INT, SPIRV_OP_TYPE_FLOAT, SPIRV_OP_TYPE_VECTOR, SPIRV_OP_TYPE_MATRIX,
+            SPIRV_OP_TYPE_ARRAY, SPIRV_OP_TYPE_RUNTIME_ARRAY, SPIRV_OP_TYPE_STRUCT}) {
+        size_t i = spirvFind(code, opcode, 1, type);
+        if (i != 0)
+            return i;
+    }
+    return 0;
+}
+
+// Literal of a decoration of an id, or missing if it isn't decorated so
+constexpr uint32_t spirvDecoration(SpirvCode code, uint32_t id, uint32_t decoration, uint32_t missing = UINT32_MAX) {
+    for(size_t i = SPIRV_HEADER_WORDS; i < code.wordCount;) {
+        uint32_t length = code.words[i] >> 16;
+        if (length == 0)
+            break;
+        if ((code.words[i] & 0xffff) == SPIRV_OP_DECORATE && length > 3 && code.words[i + 1] == id && code.words[i + 2] == decoration)
+            return code.words[i + 3];
+        i += length;
+    }
+    return missing;
+}
+
+constexpr uint32_t spirvMemberDecoration(SpirvCode code, uint32_t structType, uint32_t member, uint32_t decoration, uint32_t missing = UINT32_MAX) {
+    for(size_t i = SPIRV_HEADER_WORDS; i < code.wordCount;) {
+        uint32_t length = code.words[i] >> 16;
+        if (length == 0)
+            break;
+        if ((code.words[i] & 0xffff) == SPIRV_OP_MEMBER_DECORATE && length > 4 && code.words[i + 1] == structType
+                && code.words[i + 2] == member && code.words[i + 3] == decoration)
+            return code.words[i + 4];
+        i += length;
+    }
+    return missing;
+}
+
+// Struct type of the uniform or storage block bound at set and binding,
+// looking through arrays of blocks, or 0 if nothing is bound there
+constexpr uint32_t spirvBlockType(SpirvCode code, uint32_t set, uint32_t binding) {
+    for(size_t i = SPIRV_HEADER_WORDS; i < code.wordCount;) {
+        uint32_t length = code.words[i] >> 16;
+        if (length == 0)
+            break;
+        if ((code.words[i] & 0xffff) == SPIRV_OP_DECORATE && length > 3 && code.words[i + 2] == SPIRV_DECORATION_BINDING
+                && code.words[i + 3] == binding && spirvDecoration(code, code.words[i + 1], SPIRV_DECORATION_DESCRIPTOR_SET) == set) {
+            size_t variable = spirvFind(code, SPIRV_OP_VARIABLE, 2, code.words[i + 1]);
+            size_t pointer = variable ? spirvFind(code, SPIRV_OP_TYPE_POINTER, 1, code.words[variable + 1]) : 0;
+            if (pointer == 0)
+                return 0;
+
+            uint32_t type = code.words[pointer + 3];
+            size_t declaration = spirvFindType(code, type);
+            while (declaration != 0 && ((code.words[declaration] & 0xffff) == SPIRV_OP_TYPE_ARRAY
+                    || (code.words[declaration] & 0xffff) == SPIRV_OP_TYPE_RUNTIME_ARRAY)) {
+                type = code.words[declaration + 2];
+                declaration = spirvFindType(code, type);
+            }
+            return type;
+        }
+        i += length;
+    }
+    return 0;
+}
+
+constexpr uint32_t spirvMemberCount(SpirvCode code, uint32_t structType) {
+    size_t i = spirvFind(code, SPIRV_OP_TYPE_STRUCT, 1, structType);
+    return i ? (code.words[i] >> 16) - 2 : 0;
+}
+
+constexpr uint32_t spirvMemberType(SpirvCode code, uint32_t structType, uint32_t member) {
+    size_t i = spirvFind(code, SPIRV_OP_TYPE_STRUCT, 1, structType);
+    return i ? code.words[i + 2 + member] : 0;
+}
+
+constexpr uint32_t spirvMemberOffset(SpirvCode code, uint32_t structType, uint32_t member) {
+    return spirvMemberDecoration(code, structType, member, SPIRV_DECORATION_OFFSET);
+}
+
+// Bytes a type takes up in a block, as laid out by its decorations. Runtime
+// arrays count as empty; matrices are assumed to have 16 byte columns.
+constexpr uint32_t spirvTypeSize(SpirvCode code, uint32_t type) {
+    size_t i = spirvFindType(code, type);
+    if (i == 0)
+        return 0;
+
+    switch (code.words[i] & 0xffff) {
+        case SPIRV_OP_TYPE_INT:
+        case SPIRV_OP_TYPE_FLOAT:
+            return code.words[i + 2] / 8;
+        case SPIRV_OP_TYPE_VECTOR:
+            return code.words[i + 3] * spirvTypeSize(code, code.words[i + 2]);
+        case SPIRV_OP_TYPE_MATRIX:
+            return code.words[i + 3] * 16;
+        case SPIRV_OP_TYPE_ARRAY: {
+            size_t length = spirvFind(code, SPIRV_OP_CONSTANT, 2, code.words[i + 3]);
+            return length ? code.words[length + 3] * spirvDecoration(code, type, SPIRV_DECORATION_ARRAY_STRIDE, 0) : 0;
+        }
+        case SPIRV_OP_TYPE_STRUCT: {
+            // Up to the end of its last member, without trailing padding
+            uint32_t size = 0;
+            for(uint32_t member = 0; member < spirvMemberCount(code, type); member++) {
+                uint32_t end = spirvMemberOffset(code, type, member) + spirvTypeSize(code, spirvMemberType(code, type, member));
+                size = end > size ? end : size;
+            }
+            return size;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Stride of the array that is the first member of the block bound at set and
+// binding, e.g. of a storage buffer holding one struct per object
+constexpr uint32_t spirvArrayStride(SpirvCode code, uint32_t set, uint32_t binding) {
+    return spirvDecoration(code, spirvMemberType(code, spirvBlockType(code, set, binding), 0), SPIRV_DECORATION_ARRAY_STRIDE, 0);
+}
+
+#endif
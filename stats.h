@@ -0,0 +1,188 @@
+#ifndef VULKAN_STATS_H
+#define VULKAN_STATS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+// GPU cost of the draws that used one shader program
+struct ProgramStats {
+    uint64_t samples = 0;       // Frames the program was measured in
+    double gpuMs = 0.0;
+    uint64_t fragments = 0;     // Fragment shader invocations, if supported
+
+    void add(const ProgramStats& other) {
+        samples += other.samples;
+        gpuMs += other.gpuMs;
+        fragments += other.fragments;
+    }
+};
+
+struct FrameStats {
+    uint64_t draws = 0;
+    uint64_t pipelineBinds = 0;
+    uint64_t descriptorSetBinds = 0;
+    uint64_t vertexBufferBinds = 0;
+    uint64_t pushConstantUpdates = 0;
+    uint64_t uploadBytes = 0;       // Written to buffers the GPU reads
+    uint64_t clusterLights = 0;     // Entries in the light clusters' index list
+    double sortMs = 0.0;
+    double clusterMs = 0.0;         // Assigning lights to clusters
+    double recordMs = 0.0;
+    double frameMs = 0.0;           // Since the previous frame started
+    // Blocked on the frame's fence and in vkAcquireNextImageKHR, then
+    // spent in vkQueueSubmit and vkQueuePresentKHR
+    double fenceWaitMs = 0.0;
+    double acquireMs = 0.0;
+    double submitMs = 0.0;
+    double presentMs = 0.0;
+    uint64_t inputs = 0;            // Frames that were the first to react to input
+    double inputLatencyMs = 0.0;    // From that input until vkQueuePresentKHR returned
+    double limiterSleepMs = 0.0;    // Held back by the frame limiter
+    double limiterSpinMs = 0.0;
+    uint64_t fallbackPrograms = 0;  // Drawn with the fallback pipeline
+    // Indexed by shader program; only filled in when GPU queries are enabled
+    std::vector<ProgramStats> programs;
+
+    void add(const FrameStats& other) {
+        draws += other.draws;
+        pipelineBinds += other.pipelineBinds;
+        descriptorSetBinds += other.descriptorSetBinds;
+        vertexBufferBinds += other.vertexBufferBinds;
+        pushConstantUpdates += other.pushConstantUpdates;
+        uploadBytes += other.uploadBytes;
+        clusterLights += other.clusterLights;
+        sortMs += other.sortMs;
+        clusterMs += other.clusterMs;
+        recordMs += other.recordMs;
+        frameMs += other.frameMs;
+        fenceWaitMs += other.fenceWaitMs;
+        acquireMs += other.acquireMs;
+        submitMs += other.submitMs;
+        presentMs += other.presentMs;
+        inputs += other.inputs;
+        inputLatencyMs += other.inputLatencyMs;
+        limiterSleepMs += other.limiterSleepMs;
+        limiterSpinMs += other.limiterSpinMs;
+        fallbackPrograms += other.fallbackPrograms;
+        if (programs.size() < other.programs.size())
+            programs.resize(other.programs.size());
+        for(size_t i = 0; i < other.programs.size(); i++)
+            programs[i].add(other.programs[i]);
+    }
+};
+
+// Sums up FrameStats and prints their per-frame averages once per interval
+class StatsReporter {
+    public:
+        StatsReporter(double intervalSeconds = 1.0) : interval(intervalSeconds) {}
+
+        void setProgramNames(const std::vector<std::string>& names) { programNames = names; }
+
+        void addFrame(const FrameStats& frame) {
+            total.add(frame);
+            frameTimes.push_back(frame.frameMs);
+            frames++;
+
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - intervalStart).count();
+            if (elapsed < interval)
+                return;
+
+            // A single stalled frame hides in the average but not in the
+            // 99th percentile
+            std::sort(frameTimes.begin(), frameTimes.end());
+            double p99 = frameTimes[std::min(frameTimes.size() - 1, frameTimes.size() * 99 / 100)];
+
+            double perFrame = 1.0 / frames;
+            double mean = total.frameMs * perFrame;
+            double variance = 0.0;
+            for(double time: frameTimes)
+                variance += (time - mean) * (time - mean);
+            double jitter = std::sqrt(variance * perFrame);
+
+            // CPU time of all threads, so more than one busy core shows
+            // up as over 100%
+            double cpuTime = processCpuTime();
+            double cpu = (cpuTime - intervalCpuTime) / elapsed * 100.0;
+
+            printf(
+                "%.1f fps | cpu %.0f%% | frame %.2f ms, jitter %.2f ms, p99 %.2f ms | draws %.0f | binds: pipeline %.1f, descriptor set %.1f, vertex buffer %.1f | push constants %.1f | uploads %.0f bytes | sort %.3f ms | record %.3f ms\n",
+                frames / elapsed,
+                cpu,
+                mean,
+                jitter,
+                p99,
+                total.draws * perFrame,
+                total.pipelineBinds * perFrame,
+                total.descriptorSetBinds * perFrame,
+                total.vertexBufferBinds * perFrame,
+                total.pushConstantUpdates * perFrame,
+                total.uploadBytes * perFrame,
+                total.sortMs * perFrame,
+                total.recordMs * perFrame
+            );
+
+            printf(
+                "  waits: fence %.3f ms, acquire %.3f ms | submit %.3f ms | present %.3f ms",
+                total.fenceWaitMs * perFrame,
+                total.acquireMs * perFrame,
+                total.submitMs * perFrame,
+                total.presentMs * perFrame
+            );
+            if (total.inputs > 0)
+                printf(" | input to present %.2f ms", total.inputLatencyMs / total.inputs);
+            if (total.limiterSleepMs + total.limiterSpinMs > 0.0)
+                printf(" | limiter: sleep %.3f ms, spin %.3f ms", total.limiterSleepMs * perFrame, total.limiterSpinMs * perFrame);
+            printf("\n");
+
+            if (total.clusterLights > 0)
+                printf("  light clusters: %.0f light indices | build %.3f ms\n", total.clusterLights * perFrame, total.clusterMs * perFrame);
+
+            if (total.fallbackPrograms > 0)
+                printf("  %.1f programs drawn with the fallback pipeline\n", total.fallbackPrograms * perFrame);
+
+            for(size_t i = 0; i < total.programs.size(); i++) {
+                const ProgramStats& program = total.programs[i];
+                if (program.samples == 0)
+                    continue;
+
+                const char *name = i < programNames.size() ? programNames[i].c_str() : "program";
+                double gpuMs = program.gpuMs / program.samples;
+                if (program.fragments > 0) {
+                    double fragments = double(program.fragments) / program.samples;
+                    printf("  %s: gpu %.3f ms | %.0f fragments | %.3f ns/fragment\n", name, gpuMs, fragments, gpuMs * 1e6 / fragments);
+                } else
+                    printf("  %s: gpu %.3f ms\n", name, gpuMs);
+            }
+
+            total = FrameStats();
+            frameTimes.clear();
+            frames = 0;
+            intervalStart = now;
+            intervalCpuTime = cpuTime;
+        }
+
+    private:
+        static double processCpuTime() {
+            timespec time;
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+            return time.tv_sec + time.tv_nsec * 1e-9;
+        }
+
+        double interval;
+        std::vector<std::string> programNames;
+        std::chrono::steady_clock::time_point intervalStart = std::chrono::steady_clock::now();
+        double intervalCpuTime = processCpuTime();
+        FrameStats total;
+        std::vector<double> frameTimes;
+        uint64_t frames = 0;
+};
+
+#endif
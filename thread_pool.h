@@ -0,0 +1,123 @@
+#ifndef VULKAN_THREAD_POOL_H
+#define VULKAN_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+    public:
+        ThreadPool(size_t threadCount = std::max(1u, std::thread::hardware_concurrency())) {
+            for(size_t i = 0; i < threadCount; i++)
+                workers.emplace_back([this]() { workerLoop(); });
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wakeWorkers.notify_all();
+            for(auto& worker: workers)
+                worker.join();
+        }
+
+        size_t size() const { return workers.size(); }
+
+        void submit(std::function<void()> task) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back(std::move(task));
+            }
+            wakeWorkers.notify_one();
+        }
+
+        // Splits [0, count) into chunks of chunkSize and calls
+        // body(begin, end, chunkIndex) for each of them. The calling thread
+        // helps out and only returns once every chunk has finished.
+        template<typename Body>
+        void parallelFor(size_t count, size_t chunkSize, Body&& body) {
+            if (count == 0)
+                return;
+
+            chunkSize = std::max<size_t>(chunkSize, 1);
+            size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+            if (chunkCount == 1) {
+                body(size_t(0), count, size_t(0));
+                return;
+            }
+
+            // Shared so that helpers which only get scheduled after all the
+            // work is done can still safely find out there is nothing left
+            auto state = std::make_shared<ParallelForState>();
+            state->chunkCount = chunkCount;
+            state->runChunk = [&body, chunkSize, count](size_t chunk) {
+                size_t begin = chunk * chunkSize;
+                body(begin, std::min(begin + chunkSize, count), chunk);
+            };
+
+            size_t helpers = std::min(workers.size(), chunkCount - 1);
+            for(size_t i = 0; i < helpers; i++)
+                submit([state]() { state->run(); });
+            state->run();
+
+            std::unique_lock<std::mutex> lock(state->doneMutex);
+            state->done.wait(lock, [&]() { return state->finishedChunks.load() == chunkCount; });
+        }
+
+    private:
+        struct ParallelForState {
+            std::atomic<size_t> nextChunk{0};
+            std::atomic<size_t> finishedChunks{0};
+            size_t chunkCount = 0;
+            std::function<void(size_t)> runChunk;
+            std::mutex doneMutex;
+            std::condition_variable done;
+
+            void run() {
+                size_t chunk;
+                while ((chunk = nextChunk.fetch_add(1)) < chunkCount) {
+                    runChunk(chunk);
+                    if (finishedChunks.fetch_add(1) + 1 == chunkCount) {
+                        std::lock_guard<std::mutex> lock(doneMutex);
+                        done.notify_all();
+                    }
+                }
+            }
+        };
+
+        void workerLoop() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wakeWorkers.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                    if (stopping && tasks.empty())
+                        return;
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable wakeWorkers;
+        bool stopping = false;
+};
+
+// Shared pool for the CPU-side per-frame jobs
+inline ThreadPool& workerPool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+#endif
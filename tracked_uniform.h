@@ -0,0 +1,79 @@
+#ifndef VULKAN_TRACKED_UNIFORM_H
+#define VULKAN_TRACKED_UNIFORM_H
+
+#include "uniform_layout.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Dirty state is kept per std140 row of 16 bytes
+const size_t UNIFORM_ROW_SIZE = 16;
+
+// CPU copy of a uniform block that is mirrored into one mapped buffer per
+// frame in flight. set() marks the rows of a field dirty in every copy, but
+// only if its value changed; flush() then writes just the rows that are
+// stale in one frame's copy, which for a block that didn't change is
+// nothing at all. Block is a UniformBlock.
+template<typename Block>
+class TrackedUniform {
+    static_assert(Block::SIZE <= 64 * UNIFORM_ROW_SIZE, "The dirty rows of a block have to fit in 64 bits");
+
+    public:
+        // Every copy starts out dirty, e.g. after its buffers were created
+        void reset(size_t frameCount) {
+            dirtyRows.assign(frameCount, rowMask(0, Block::SIZE));
+        }
+
+        template<size_t Field>
+        void set(const typename Block::template Type<Field>& value) {
+            if (!block.template set<Field>(value))
+                return;
+
+            uint64_t rows = rowMask(Block::offset(Field), Block::fieldSize(Field));
+            for(auto& dirty: dirtyRows)
+                dirty |= rows;
+        }
+
+        const Block& get() const { return block; }
+
+        // Writes the stale rows of one frame's copy and returns how many
+        // bytes that took
+        size_t flush(size_t frame, void *mapped) {
+            uint64_t dirty = dirtyRows[frame];
+            dirtyRows[frame] = 0;
+
+            // Runs of dirty rows are copied at once
+            size_t written = 0;
+            for(size_t row = 0; row * UNIFORM_ROW_SIZE < Block::SIZE; row++) {
+                if (!(dirty & (uint64_t(1) << row)))
+                    continue;
+
+                size_t end = row + 1;
+                while (end * UNIFORM_ROW_SIZE < Block::SIZE && (dirty & (uint64_t(1) << end)))
+                    end++;
+
+                size_t begin = row * UNIFORM_ROW_SIZE;
+                size_t size = std::min(end * UNIFORM_ROW_SIZE, Block::SIZE) - begin;
+                memcpy(static_cast<char *>(mapped) + begin, block.data() + begin, size);
+                written += size;
+                row = end;
+            }
+            return written;
+        }
+
+    private:
+        static uint64_t rowMask(size_t offset, size_t size) {
+            size_t first = offset / UNIFORM_ROW_SIZE;
+            size_t last = (offset + size - 1) / UNIFORM_ROW_SIZE;
+            uint64_t mask = last == 63 ? ~uint64_t(0) : (uint64_t(1) << (last + 1)) - 1;
+            return mask & ~((uint64_t(1) << first) - 1);
+        }
+
+        Block block;
+        std::vector<uint64_t> dirtyRows;
+};
+
+#endif
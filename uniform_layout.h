@@ -0,0 +1,169 @@
+#ifndef VULKAN_UNIFORM_LAYOUT_H
+#define VULKAN_UNIFORM_LAYOUT_H
+
+#include "spirv.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+
+#include <glm/glm.hpp>
+
+enum LayoutRules {
+    LAYOUT_STD140,      // Uniform blocks; array strides are rounded up to 16 bytes
+    LAYOUT_STD430       // Storage blocks; arrays are packed like their elements
+};
+
+// Size and base alignment of the GLSL type a host type stands for
+template<typename T> struct GlslType;
+template<> struct GlslType<float> { static constexpr size_t size = 4, alignment = 4; };
+template<> struct GlslType<int32_t> { static constexpr size_t size = 4, alignment = 4; };
+template<> struct GlslType<uint32_t> { static constexpr size_t size = 4, alignment = 4; };
+template<> struct GlslType<glm::vec2> { static constexpr size_t size = 8, alignment = 8; };
+template<> struct GlslType<glm::vec3> { static constexpr size_t size = 12, alignment = 16; };
+template<> struct GlslType<glm::vec4> { static constexpr size_t size = 16, alignment = 16; };
+template<> struct GlslType<glm::mat4> { static constexpr size_t size = 64, alignment = 16; };
+
+constexpr size_t alignLayout(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// How a field is laid out under a set of rules; arrays are copied one
+// element at a time since their stride may exceed the host's
+template<LayoutRules Rules, typename T>
+struct FieldLayout {
+    typedef T Element;
+    static constexpr size_t count = 1;
+    static constexpr size_t alignment = GlslType<T>::alignment;
+    static constexpr size_t stride = GlslType<T>::size;
+    static constexpr size_t size = GlslType<T>::size;
+};
+
+template<LayoutRules Rules, typename T, size_t N>
+struct FieldLayout<Rules, T[N]> {
+    typedef T Element;
+    static constexpr size_t count = N;
+    static constexpr size_t alignment = Rules == LAYOUT_STD140 && GlslType<T>::alignment < 16 ? 16 : GlslType<T>::alignment;
+    static constexpr size_t stride = alignLayout(GlslType<T>::size, alignment);
+    static constexpr size_t size = stride * N;
+};
+
+// Offsets of a block's fields in the order they're packed in
+template<size_t N>
+struct BlockPacking {
+    size_t offsets[N] = {};
+    size_t size = 0;
+};
+
+// Places the fields one by one at the lowest offset left. Of the fields that
+// fit there without padding, the most aligned one goes first, so a vec3 is
+// followed by a scalar that fills the rest of its row; declaration order
+// breaks ties. Only if none fits is padding inserted.
+template<size_t N>
+constexpr BlockPacking<N> packFields(const size_t (&sizes)[N], const size_t (&alignments)[N]) {
+    BlockPacking<N> packing;
+    bool placed[N] = {};
+    for(size_t step = 0; step < N; step++) {
+        size_t best = N;
+        bool bestFits = false;
+        for(size_t field = 0; field < N; field++) {
+            if (placed[field])
+                continue;
+            bool fits = alignLayout(packing.size, alignments[field]) == packing.size;
+            if (best == N || (fits && !bestFits) || (fits == bestFits && alignments[field] > alignments[best])) {
+                best = field;
+                bestFits = fits;
+            }
+        }
+        placed[best] = true;
+        packing.offsets[best] = alignLayout(packing.size, alignments[best]);
+        packing.size = packing.offsets[best] + sizes[best];
+    }
+    return packing;
+}
+
+// Packing of a list of fields, see UniformBlock
+template<LayoutRules Rules, typename... Fields>
+struct BlockLayout {
+    static constexpr size_t SIZES[sizeof...(Fields)] = {FieldLayout<Rules, Fields>::size...};
+    static constexpr size_t ALIGNMENTS[sizeof...(Fields)] = {FieldLayout<Rules, Fields>::alignment...};
+    static constexpr BlockPacking<sizeof...(Fields)> PACKING = packFields(SIZES, ALIGNMENTS);
+};
+
+// Host copy of a uniform or storage block whose fields are declared once, as
+// a list of types. Their offsets and the block's size follow from the layout
+// rules at compile time, with the fields reordered to waste as little space
+// as possible; the shader has to declare its members in that order, which
+// matches() checks. Fields are named by an enum listing them in declaration
+// order, e.g. block.set<LIGHT_COLOR>(color).
+template<LayoutRules Rules, typename... Fields>
+class UniformBlock {
+    public:
+        static constexpr size_t FIELD_COUNT = sizeof...(Fields);
+
+        template<size_t Field>
+        using Type = typename std::tuple_element<Field, std::tuple<Fields...>>::type;
+
+        static constexpr size_t offset(size_t field) { return Layout::PACKING.offsets[field]; }
+        static constexpr size_t fieldSize(size_t field) { return Layout::SIZES[field]; }
+
+        static constexpr size_t SIZE = BlockLayout<Rules, Fields...>::PACKING.size;
+        // Bytes between the fields that hold nothing
+        static constexpr size_t PADDING = SIZE - (FieldLayout<Rules, Fields>::size + ...);
+
+        // Returns whether the field's value changed
+        template<size_t Field>
+        bool set(const Type<Field>& value) {
+            typedef FieldLayout<Rules, Type<Field>> Placement;
+            typedef typename Placement::Element Element;
+            const Element *elements = reinterpret_cast<const Element *>(&value);
+            unsigned char *destination = bytes + offset(Field);
+
+            bool changed = false;
+            for(size_t i = 0; i < Placement::count; i++, destination += Placement::stride) {
+                if (memcmp(destination, &elements[i], GlslType<Element>::size) != 0) {
+                    memcpy(destination, &elements[i], GlslType<Element>::size);
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        template<size_t Field>
+        Type<Field> get() const {
+            static_assert(!std::is_array<Type<Field>>::value, "Arrays can't be returned by value");
+            Type<Field> value = {};
+            memcpy(&value, bytes + offset(Field), GlslType<Type<Field>>::size);
+            return value;
+        }
+
+        const unsigned char *data() const { return bytes; }
+
+        // Whether the shader's block at set and binding has the fields at
+        // the same offsets and the same size
+        static constexpr bool matches(SpirvCode code, uint32_t set, uint32_t binding) {
+            uint32_t type = spirvBlockType(code, set, binding);
+            if (type == 0 || spirvMemberCount(code, type) != FIELD_COUNT || spirvTypeSize(code, type) != SIZE)
+                return false;
+
+            // Members are declared in packed order
+            for(size_t field = 0; field < FIELD_COUNT; field++) {
+                size_t member = 0;
+                for(size_t other = 0; other < FIELD_COUNT; other++)
+                    member += offset(other) < offset(field);
+                if (spirvMemberOffset(code, type, member) != offset(field)
+                        || spirvTypeSize(code, spirvMemberType(code, type, member)) != fieldSize(field))
+                    return false;
+            }
+            return true;
+        }
+
+    private:
+        typedef BlockLayout<Rules, Fields...> Layout;
+
+        alignas(16) unsigned char bytes[SIZE] = {};
+};
+
+#endif
@@ -28,12 +28,37 @@ class Window {
         }
 
         void pollEvents() { glfwPollEvents(); }
+        // Blocks until there are events, then processes them
+        void waitEvents() { glfwWaitEvents(); }
+        bool isMinimized() { return glfwGetWindowAttrib(window, GLFW_ICONIFIED); }
         GLFWwindow *getWindow() { return window; }
 
         void getFramebufferSize(int *width, int *height) {
             glfwGetFramebufferSize(window, width, height);
         }
 
+        void getWindowSize(int *width, int *height) {
+            glfwGetWindowSize(window, width, height);
+        }
+
+        void getCursorPos(double *x, double *y) {
+            glfwGetCursorPos(window, x, y);
+        }
+
+        void setMouseButtonCallback(GLFWmousebuttonfun mouseButtonCallback) {
+            glfwSetMouseButtonCallback(window, mouseButtonCallback);
+        }
+
+        void setKeyCallback(GLFWkeyfun keyCallback) {
+            glfwSetKeyCallback(window, keyCallback);
+        }
+
+        // Called when the window's contents were lost, e.g. after it was
+        // uncovered
+        void setRefreshCallback(GLFWwindowrefreshfun refreshCallback) {
+            glfwSetWindowRefreshCallback(window, refreshCallback);
+        }
+
         std::vector<const char *> getRequiredExtensions() {
             uint32_t glfwExtensionCount = 0;
             const char **glfwExtensions;